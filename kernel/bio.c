@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,18 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are chained into NBUCKET buckets by (dev, blockno),
+// each with its own lock, so lookups of different blocks
+// don't contend. A bucket lock protects the chain and the
+// refcnt and lastuse of the buffers on it. A miss recycles
+// an unused buffer from its own bucket; bcache.lock is only
+// taken when there is none, to serialize stealing buffers
+// from other buckets.
+//
+// breadahead() starts reading blocks into unreferenced buffers
+// without waiting; the disk owns such a buffer (b->disk) until
+// the read finishes, and bread() waits for it to finish.
 
 
 #include "types.h"
@@ -23,69 +35,227 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 13
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;
+};
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bkt;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Spread the buffers over the buckets; they hold no
+  // block yet, so it doesn't matter which.
+  for(i = 0; i < NBUF; i++){
+    b = &bcache.buf[i];
+    bkt = &bcache.bucket[i % NBUCKET];
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bkt->head;
+    bkt->head = b;
+  }
+}
+
+// Return the buffer for block blockno on dev in bucket bkt,
+// or 0 if it isn't cached. Caller must hold bkt->lock.
+static struct buf*
+bfind(struct bucket *bkt, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bkt->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
   }
+  return 0;
+}
+
+// Find the least recently used unused buffer in bucket bkt.
+// Buffers the disk is still reading ahead into aren't
+// candidates; set *busy to one of those, and add the number
+// of candidates to *nfree.
+// Caller must hold bkt->lock.
+static struct buf*
+blru(struct bucket *bkt, struct buf **busy, int *nfree)
+{
+  struct buf *b, *victim;
+
+  victim = 0;
+  for(b = bkt->head; b != 0; b = b->next){
+    if(b->refcnt != 0)
+      continue;
+    if(b->disk){
+      *busy = b;
+      continue;
+    }
+    (*nfree)++;
+    if(victim == 0 || b->lastuse < victim->lastuse)
+      victim = b;
+  }
+  return victim;
+}
+
+// Find the least recently used unused buffer in any bucket,
+// and set *pbkt to the bucket that holds it. Sets *busy and
+// *nfree as blru() does, over all the buckets.
+// Caller must hold bcache.lock and held->lock.
+static struct buf*
+bvictim(struct bucket *held, struct bucket **pbkt, struct buf **busy, int *nfree)
+{
+  struct buf *b, *victim;
+  struct bucket *bkt;
+
+  victim = 0;
+  *pbkt = 0;
+  *busy = 0;
+  *nfree = 0;
+  for(bkt = bcache.bucket; bkt < bcache.bucket+NBUCKET; bkt++){
+    if(bkt != held)
+      acquire(&bkt->lock);
+    b = blru(bkt, busy, nfree);
+    if(b != 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+      victim = b;
+      *pbkt = bkt;
+    }
+    if(bkt != held)
+      release(&bkt->lock);
+  }
+  return victim;
+}
+
+// Give unused buffer b, already on the chain of
+// (dev, blockno)'s bucket, to that block.
+// Caller must hold the bucket's lock.
+static void
+brecycle(struct buf *b, uint dev, uint blockno)
+{
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->ahead = 0;
+  b->refcnt = 1;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead, return 0 instead if the block is
+// already cached or buffers are scarce.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
+  struct buf *b, *busy, **pp;
+  struct bucket *bkt, *vbkt;
+  int nfree;
 
-  acquire(&bcache.lock);
+  bkt = &bcache.bucket[BHASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bkt->lock);
+  if((b = bfind(bkt, dev, blockno)) != 0){
+    if(ahead){
+      release(&bkt->lock);
+      return 0;
     }
+    b->refcnt++;
+    release(&bkt->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Not cached. Recycle the least recently used (LRU) unused
+  // buffer in the block's own bucket if there is one. Holding
+  // bkt->lock since the lookup, no one else can cache the
+  // block meanwhile. Read-ahead leaves a bucket's last unused
+  // buffer for demand reads.
+  busy = 0;
+  nfree = 0;
+  if((b = blru(bkt, &busy, &nfree)) != 0 && (!ahead || nfree > 1)){
+    brecycle(b, dev, blockno);
+    release(&bkt->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bkt->lock);
+
+  // Steal the LRU unused buffer from another bucket. Only one
+  // CPU at a time may steal, so two can't pick the same
+  // victim. The stealer holds bkt->lock throughout, so no one
+  // can cache the block meanwhile, and it is the only CPU
+  // that holds two bucket locks, so that can't deadlock.
+  acquire(&bcache.lock);
+  acquire(&bkt->lock);
+  for(;;){
+    // Another CPU may have cached the block while we
+    // waited for bcache.lock.
+    if((b = bfind(bkt, dev, blockno)) != 0){
       release(&bcache.lock);
+      if(ahead){
+        release(&bkt->lock);
+        return 0;
+      }
+      b->refcnt++;
+      release(&bkt->lock);
       acquiresleep(&b->lock);
       return b;
     }
+
+    b = bvictim(bkt, &vbkt, &busy, &nfree);
+    if(ahead && nfree <= NREADAHEAD){
+      release(&bkt->lock);
+      release(&bcache.lock);
+      return 0;
+    }
+    if(b != 0){
+      if(vbkt == bkt)
+        break;
+      // a lookup may have grabbed b before we relocked
+      // its bucket, in which case look for another.
+      acquire(&vbkt->lock);
+      if(b->refcnt == 0 && b->disk == 0)
+        break;
+      release(&vbkt->lock);
+      continue;
+    }
+    if(busy == 0)
+      panic("bget: no buffers");
+
+    // Every unused buffer is being read ahead into.
+    // Wait for one, then look again.
+    release(&bkt->lock);
+    release(&bcache.lock);
+    virtio_disk_wait(busy);
+    acquire(&bcache.lock);
+    acquire(&bkt->lock);
+  }
+  if(vbkt != bkt){
+    for(pp = &vbkt->head; *pp != b; pp = &(*pp)->next)
+      ;
+    *pp = b->next;
+    release(&vbkt->lock);
+    b->next = bkt->head;
+    bkt->head = b;
   }
-  panic("bget: no buffers");
+  brecycle(b, dev, blockno);
+  release(&bkt->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,14 +264,46 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    if(b->ahead)
+      virtio_disk_wait(b);
+    else
+      virtio_disk_rw(b, 0);
+    b->ahead = 0;
     b->valid = 1;
   }
   return b;
 }
 
+// Start reading the n blocks blocknos[] of dev into the
+// cache, skipping those already cached, without waiting
+// for the reads to finish. Consecutive blocks are read
+// with one disk request.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *b[NREADAHEAD];
+  int i, m, run;
+
+  m = 0;
+  for(i = 0; i < n && m < NREADAHEAD; i++){
+    if((b[m] = bget(dev, blocknos[i], 1)) != 0)
+      b[m++]->ahead = 1;
+  }
+
+  for(i = 0; i < m; i += run){
+    for(run = 1; i + run < m; run++){
+      if(b[i+run]->blockno != b[i]->blockno + run)
+        break;
+    }
+    virtio_disk_start(&b[i], run, 0);
+  }
+
+  for(i = 0; i < m; i++)
+    brelse(b[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,42 +314,41 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Stamp it with the time, for LRU recycling in bget().
 void
 brelse(struct buf *b)
 {
+  struct bucket *bkt;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bkt->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bkt->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bkt->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
-
-
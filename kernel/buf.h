@@ -1,12 +1,13 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // being or been read ahead, but not yet valid
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint lastuse;     // ticks at last brelse(), for LRU recycling
+  struct buf *next; // hash bucket chain
   uchar data[BSIZE];
 };
 
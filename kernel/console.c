@@ -21,6 +21,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "fcntl.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +52,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct pollq poll;  // poll()s waiting for input
 } cons;
 
 //
@@ -74,10 +77,11 @@ consolewrite(int user_src, uint64 src, int n)
 // user read()s from the console go here.
 // copy (up to) a whole input line to dst.
 // user_dist indicates whether dst is a user
-// or kernel address.
+// or kernel address. if nonblock, don't wait
+// for input.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, int nonblock)
 {
   uint target;
   int c;
@@ -93,6 +97,10 @@ consoleread(int user_dst, uint64 dst, int n)
         release(&cons.lock);
         return -1;
       }
+      if(nonblock){
+        release(&cons.lock);
+        return n < target ? target - n : -EAGAIN;
+      }
       sleep(&cons.r, &cons.lock);
     }
 
@@ -170,6 +178,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup(&cons.poll);
       }
     }
     break;
@@ -178,6 +187,25 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+//
+// poll() on the console: it is readable once a
+// whole line has arrived, and always writable.
+//
+int
+consolepoll(struct pollent *pe)
+{
+  int ev;
+
+  acquire(&cons.lock);
+  ev = POLLOUT;
+  if(cons.r != cons.w)
+    ev |= POLLIN;
+  if(pe)
+    pollwait(pe, &cons.poll, &cons.lock);
+  release(&cons.lock);
+  return ev;
+}
+
 void
 consoleinit(void)
 {
@@ -189,4 +217,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -2,16 +2,22 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
+struct pollent;
+struct pollfd;
+struct pollq;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint*, int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -25,21 +31,32 @@ void            consputc(int);
 // exec.c
 int             exec(char*, char**);
 
+// sysfile.c
+void            fdrelease(void);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollent*);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dcput(struct inode*, char*, uint, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*, int);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -52,6 +69,7 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+uint            writemax(uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -61,8 +79,11 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void            kdup(void *);
 void            kfree(void *);
 void            kinit(void);
+int             knfree(void);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -73,8 +94,24 @@ void            end_op(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, struct iovec*, int, int);
+int             pipewrite(struct pipe*, struct iovec*, int, int);
+int             pipesize(struct pipe*);
+int             piperesize(struct pipe*, int);
+int             pipefromfile(struct pipe*, struct file*, int, int);
+int             pipetofile(struct pipe*, struct file*, int, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
+// poll.c
+int             poll(struct pollfd*, int, int);
+void            polltick(void);
+void            pollwait(struct pollent*, struct pollq*, struct spinlock*);
+void            pollwakeup(struct pollq*);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,7 +122,9 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             clone(uint64, uint64, uint64);
+int             join(uint64);
+uint64          growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -102,6 +141,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -114,13 +154,17 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlock_noreg(struct spinlock*, char*);
+int             lockstat(char*, uint64*, uint64*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             acquiresleepkillable(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -165,8 +209,17 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void            vmprefault(uint64, uint64);
+struct vma*     vmalookup(struct proc*, uint64, uint64);
+uint64          vmamap(uint64, int, int, struct inode*, uint, uint);
+int             vmaunmap(uint64, uint64);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaclear(pagetable_t, struct vma*);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmunmaplazy(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
@@ -183,6 +236,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
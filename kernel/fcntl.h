@@ -3,3 +3,30 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
+
+// A read or write of an O_NONBLOCK file that would
+// have to wait fails with -EAGAIN instead.
+#define EAGAIN 11
+
+// mmap() prot
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+// mmap() flags
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+
+// readv() and writev() buffers
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
+#define IOV_MAX 16
+
+// fcntl() commands
+#define F_GETFL      3
+#define F_SETFL      4
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
@@ -10,6 +10,8 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "poll.h"
 #include "stat.h"
 #include "proc.h"
 
@@ -101,78 +103,153 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read from inode ip into the n user buffers iov[],
+// starting at *off, and advance *off past the bytes read.
+// *off is f->off for read() and a local for pread().
+static int
+inodereadv(struct inode *ip, struct iovec *iov, int n, uint *off)
+{
+  int i, r, tot;
+
+  tot = 0;
+  ilock(ip);
+  for(i = 0; i < n; i++){
+    r = readi(ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len);
+    if(r < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlock(ip);
+  return tot;
+}
+
+// Write the n user buffers iov[] to inode ip at *off,
+// and advance *off past the bytes written.
+static int
+inodewritev(struct inode *ip, struct iovec *iov, int n, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size; writemax() says
+  // how many. this really belongs lower down, since
+  // writei() might be writing a device like the console.
+  // each transaction takes as much of iov[] as fits.
+  int k = 0, tot = 0, n1, room, r;
+  uint64 done = 0;  // bytes of iov[k] already written
+
+  r = 0;
+  while(k < n && r >= 0){
+    begin_op();
+    ilock(ip);
+    for(room = writemax(*off); room > 0 && k < n; room -= r){
+      n1 = iov[k].iov_len - done;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(ip, 1, (uint64)iov[k].iov_base + done, *off, n1)) > 0)
+        *off += r;
+      if(r != n1){
+        // error from writei
+        r = -1;
+        break;
+      }
+      tot += r;
+      if((done += r) == iov[k].iov_len){
+        k++;
+        done = 0;
+      }
+    }
+    iunlock(ip);
+    end_op();
+  }
+  return k == n ? tot : -1;
+}
+
+// Read from file f into the n buffers iov[],
+// whose addresses are user virtual addresses.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int n)
 {
-  int r = 0;
+  int i, r, tot;
 
   if(f->readable == 0)
     return -1;
 
+  // the copies below run with locks held.
+  for(i = 0; i < n; i++)
+    vmprefault((uint64)iov[i].iov_base, iov[i].iov_len);
+
+  tot = 0;
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    tot = piperead(f->pipe, iov, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    // a device read may block; stop at the first short one.
+    for(i = 0; i < n; i++){
+      r = devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len, f->nonblock);
+      if(r < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r != iov[i].iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    tot = inodereadv(f->ip, iov, n, &f->off);
   } else {
     panic("fileread");
   }
 
-  return r;
+  return tot;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1);
+}
+
+// Write the n buffers iov[], whose addresses
+// are user virtual addresses, to file f.
+int
+filewritev(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, ret = 0;
 
   if(f->writable == 0)
     return -1;
 
+  // the copies below run with locks held.
+  for(i = 0; i < n; i++)
+    vmprefault((uint64)iov[i].iov_base, iov[i].iov_len);
+
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, iov, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
+    for(i = 0; i < n; i++){
+      r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return ret > 0 ? ret : -1;
+      ret += r;
+      if(r != iov[i].iov_len)
         break;
-      }
-      i += r;
     }
-    ret = (i == n ? n : -1);
+  } else if(f->type == FD_INODE){
+    ret = inodewritev(f->ip, iov, n, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +257,84 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1);
+}
+
+// Read n bytes from file f at offset off into user
+// address addr, leaving f->off alone. Only inodes
+// have offsets.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  vmprefault(addr, n);
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return inodereadv(f->ip, &iov, 1, &off);
+}
+
+// Write n bytes from user address addr to file f
+// at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE || n < 0)
+    return -1;
+  vmprefault(addr, n);
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return inodewritev(f->ip, &iov, 1, &off);
+}
+
+// Return the poll() events f is ready for. If pe is not 0,
+// also put it on the poll queue of f's object, to be woken
+// when that changes. Inodes, and devices without a poll
+// function, never block, so they are always ready.
+int
+filepoll(struct file *f, struct pollent *pe)
+{
+  int ev;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, pe);
+  ev = POLLIN | POLLOUT;
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].poll)
+    ev = devsw[f->major].poll(pe);
+  if(f->readable == 0)
+    ev &= ~POLLIN;
+  if(f->writable == 0)
+    ev &= ~POLLOUT;
+  return ev;
+}
+
+// Move up to n bytes from file in to file out without
+// copying them through user space. One of the files must
+// be a pipe and the other an inode.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipefromfile(out->pipe, in, n, out->nonblock);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipetofile(in->pipe, out, n, in->nonblock);
+  return -1;
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -18,6 +19,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // Program segments mapping it; see iexec()
+  struct inode *hnext;   // itable hash chain
+  struct inode *lnext;   // itable LRU list, while ref == 0
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +31,36 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+  uint leaf;          // last indirect block bmap() mapped through
+  uint leafbase;      // file block number of leaf's first entry
+  uint lastblk;       // block most recently allocated to this inode
+  uint ranext;        // block after the one the last readi() ended in
+  uint raend;         // block after the last one read ahead
+};
+
+// Processes in poll() waiting for an object, such as a pipe,
+// to become ready. Protected by the object's lock.
+struct pollq {
+  struct pollent *head;
+};
+
+// One poll()ing process's entry on one object's pollq.
+struct pollent {
+  struct polltable *pt;  // poll() it belongs to
+  struct pollq *q;       // queue it is on, or 0
+  struct spinlock *lk;   // q's object's lock
+  struct pollent *next;
+  struct pollent *prev;
 };
 
 // map major device number to device functions.
+// read's last argument is the file's O_NONBLOCK flag.
+// poll, if set, works like pipepoll().
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollent*);
 };
 
 extern struct devsw devsw[];
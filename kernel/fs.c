@@ -26,6 +26,18 @@
 // only one device
 struct superblock sb; 
 
+// In-core summary of the free-block bitmap. The bitmap
+// blocks themselves are protected by their buffer locks.
+struct {
+  struct spinlock lock;
+  uint cursor;   // where balloc() searches when it has no goal
+  uint nfree;    // free blocks, less those being allocated
+} bitmap;
+
+static void bcount(int);
+static void dcinit(void);
+static void dcpurge(struct inode*);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +56,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bcount(dev);
 }
 
 // Zero a block.
@@ -60,31 +73,94 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+// Count the free blocks in the bitmap.
+static void
+bcount(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  int b, bi;
 
-  bp = 0;
+  initlock(&bitmap.lock, "bitmap");
+  bitmap.nfree = 0;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bitmap.nfree++;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
-  return 0;
+  bitmap.cursor = 0;
+}
+
+// Return the first clear bit in bitmap block data at or
+// after bit from and before bit to, or -1 if there is none.
+// Looks at 64 bits at a time, so runs of allocated blocks
+// are skipped quickly.
+static int
+bscan(uchar *data, int from, int to)
+{
+  uint64 *w, x;
+  int i, bi;
+
+  w = (uint64*)data;
+  for(i = from / 64; i * 64 < to; i++){
+    x = w[i];
+    if(i == from / 64)
+      x |= (1L << (from % 64)) - 1;  // pretend bits before from are set
+    if(x == ~0L)
+      continue;
+    for(bi = i * 64; x & 1; bi++)
+      x >>= 1;
+    return bi < to ? bi : -1;
+  }
+  return -1;
+}
+
+// Allocate a zeroed disk block, preferably the first
+// free one at or after goal; goal 0 means no preference.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  int b, bi, n;
+  struct buf *bp;
+
+  acquire(&bitmap.lock);
+  if(bitmap.nfree == 0){
+    release(&bitmap.lock);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  bitmap.nfree--;
+  if(goal == 0 || goal >= sb.size)
+    goal = bitmap.cursor;
+  release(&bitmap.lock);
+
+  // Search from goal to the end of its bitmap block, then the
+  // following bitmap blocks, wrapping around to goal's block.
+  b = goal - goal % BPB;
+  bi = goal % BPB;
+  for(n = 0; n <= sb.size / BPB + 1; n++){
+    bp = bread(dev, BBLOCK(b, sb));
+    bi = bscan(bp->data, bi, min(BPB, sb.size - b));
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&bitmap.lock);
+      bitmap.cursor = b + bi + 1 < sb.size ? b + bi + 1 : 0;
+      release(&bitmap.lock);
+      bzero(dev, b + bi);
+      return b + bi;
+    }
+    brelse(bp);
+    b += BPB;
+    if(b >= sb.size)
+      b = 0;
+    bi = 0;
+  }
+  panic("balloc: free count");
 }
 
 // Free a disk block.
@@ -102,6 +178,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&bitmap.lock);
+  bitmap.nfree++;
+  release(&bitmap.lock);
 }
 
 // Inodes.
@@ -172,21 +252,57 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// Entries are found through a hash table keyed by dev and inum.
+// An entry whose ref drops to zero keeps its contents and stays
+// in the hash table, on an LRU list from which iget() recycles
+// entries, so a recently used inode can be had again without
+// reading it from disk.
+
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  // Sentinel of the LRU list of unreferenced entries.
+  // lru.lnext is the least recently used.
+  struct inode lru;
+  uint icursor;  // where ialloc() starts looking for a free inode
 } itable;
 
+// Append ip to the LRU list. Caller must hold itable.lock.
+static void
+ilru_add(struct inode *ip)
+{
+  ip->lprev = itable.lru.lprev;
+  ip->lnext = &itable.lru;
+  itable.lru.lprev->lnext = ip;
+  itable.lru.lprev = ip;
+}
+
+// Remove ip from the LRU list. Caller must hold itable.lock.
+static void
+ilru_remove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.lru.lnext = &itable.lru;
+  itable.lru.lprev = &itable.lru;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    ilru_add(&itable.inode[i]);
   }
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -198,11 +314,19 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int inum, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  // Start after the last inode allocated, so that creating
+  // many files doesn't rescan all the inodes in use.
+  acquire(&itable.lock);
+  inum = itable.icursor;
+  release(&itable.lock);
+
+  for(n = 1; n < sb.ninodes; n++, inum++){
+    if(inum < 1 || inum >= sb.ninodes)
+      inum = 1;
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -210,6 +334,9 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      acquire(&itable.lock);
+      itable.icursor = inum + 1;
+      release(&itable.lock);
       return iget(dev, inum);
     }
     brelse(bp);
@@ -246,31 +373,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
+  int h;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  h = IHASH(dev, inum);
+  for(ip = itable.hash[h]; ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilru_remove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used unreferenced entry.
+  ip = itable.lru.lnext;
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  ilru_remove(ip);
+  if(ip->inum != 0){
+    for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +422,20 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Note that ip is mapped as a segment of a running
+// program, or, if n is -1, that one such mapping is gone.
+// vmfault() reads a program's pages from the file as they
+// are touched, so writes to ip fail while any remain.
+// Only exec() raises nexec from zero, holding ip's lock,
+// so a writer holding the lock can check it unlocked.
+void
+iexec(struct inode *ip, int n)
+{
+  acquire(&itable.lock);
+  ip->nexec += n;
+  release(&itable.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -310,6 +459,10 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->leaf = 0;
+    ip->lastblk = 0;
+    ip->ranext = 0;
+    ip->raend = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -347,6 +500,8 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcpurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -357,7 +512,8 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    ilru_add(ip);
   release(&itable.lock);
 }
 
@@ -374,7 +530,51 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// that in the tree of indirect blocks rooted at
+// ip->addrs[NDIRECT+1], and the last NTINDIRECT in the
+// three-level tree rooted at ip->addrs[NDIRECT+2].
+//
+// ip->leaf remembers the last bottom-level indirect block
+// that bmap() walked down to, so that a sequential scan
+// costs one indirect-block read per block no matter how
+// deep in the tree it is.
+
+// Allocate a block for ip, next to the one last
+// allocated for it if possible, so that files
+// written sequentially are laid out contiguously.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr;
+
+  addr = balloc(ip->dev, ip->lastblk ? ip->lastblk + 1 : 0);
+  if(addr)
+    ip->lastblk = addr;
+  return addr;
+}
+
+// Return the address in slot i of indirect block addr,
+// allocating a block for the slot if it is empty.
+// returns 0 if out of disk space.
+static uint
+bslot(struct inode *ip, uint addr, uint i)
+{
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    addr = iballoc(ip);
+    if(addr){
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,42 +582,73 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fbn, span;
+  int i;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
     return addr;
   }
+
+  if(ip->leaf && bn - ip->leafbase < NINDIRECT)
+    return bslot(ip, ip->leaf, bn - ip->leafbase);
+
+  // Find the tree holding bn; span is the number of
+  // blocks below each entry of the tree's root.
+  fbn = bn;
   bn -= NDIRECT;
+  span = 1;
+  for(i = NDIRECT; i < NDIRECT+3; i++){
+    if(bn < span * NINDIRECT)
+      break;
+    bn -= span * NINDIRECT;
+    span *= NINDIRECT;
+  }
+  if(i == NDIRECT+3)
+    panic("bmap: out of range");
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
+  // Load the root, then walk down, allocating as necessary.
+  if((addr = ip->addrs[i]) == 0){
+    addr = iballoc(ip);
+    if(addr == 0)
+      return 0;
+    ip->addrs[i] = addr;
+  }
+  for(; span > 1; span /= NINDIRECT){
+    if((addr = bslot(ip, addr, bn / span)) == 0)
+      return 0;
+    bn %= span;
+  }
+
+  ip->leaf = addr;
+  ip->leafbase = fbn - bn;
+  return bslot(ip, addr, bn);
+}
+
+// Free the indirect block addr, and the depth levels
+// of blocks below it.
+static void
+bfreetree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  if(depth > 0){
+    bp = bread(dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bfreetree(dev, a[j], depth-1);
     }
     brelse(bp);
-    return addr;
   }
-
-  panic("bmap: out of range");
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +656,7 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,17 +665,14 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = NDIRECT; i < NDIRECT+3; i++){
+    if(ip->addrs[i]){
+      bfreetree(ip->dev, ip->addrs[i], i - NDIRECT + 1);
+      ip->addrs[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->leaf = 0;
+  ip->lastblk = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -464,6 +690,39 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// If a read of n bytes at off continues a sequential scan
+// of ip, start reading the blocks after it, so that they are
+// in the cache by the time the scan gets to them. Keeps up
+// to NREADAHEAD blocks in flight, topping the window up when
+// half of it has been consumed.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, last, addrs[NREADAHEAD];
+  int seq, i;
+
+  bn = off / BSIZE;
+  end = (off + n + BSIZE - 1) / BSIZE;
+  seq = bn == ip->ranext || bn + 1 == ip->ranext;
+  ip->ranext = end;
+  if(!seq || ip->raend < end){
+    ip->raend = end;
+    if(!seq)
+      return;
+  }
+  if(ip->raend >= end + NREADAHEAD/2)
+    return;
+
+  last = min(end + NREADAHEAD, (ip->size + BSIZE - 1) / BSIZE);
+  for(i = 0; ip->raend < last; ip->raend++){
+    if((addrs[i] = bmap(ip, ip->raend)) != 0)
+      i++;
+  }
+  if(i > 0)
+    breadahead(ip->dev, addrs, i);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -478,6 +737,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -512,6 +773,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->nexec > 0)
+    return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -538,6 +801,39 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// Return how many bytes of a file, starting at off, one
+// log transaction may write with writei(). Each data block
+// it touches may be newly allocated, as may every indirect
+// block above it, and each allocation also writes a bitmap
+// block; the inode is written too. So deeper blocks leave
+// room for fewer data blocks, and the range stops at the
+// end of its bottom-level indirect block, so that it needs
+// only one path of indirect blocks.
+uint
+writemax(uint off)
+{
+  uint bn, b, span, end, n;
+  int depth;
+
+  bn = off / BSIZE;
+  if(bn < NDIRECT){
+    depth = 0;
+    end = NDIRECT;
+  } else {
+    b = bn - NDIRECT;
+    span = NINDIRECT;
+    for(depth = 1; depth < 3 && b >= span; depth++){
+      b -= span;
+      span *= NINDIRECT;
+    }
+    end = bn - b % NINDIRECT + NINDIRECT;
+  }
+  n = (MAXOPBLOCKS - 1 - 2*depth) / 2;
+  if(bn + n > end)
+    n = end - bn;
+  return (bn + n) * BSIZE - off;
+}
+
 // Directories
 
 int
@@ -546,32 +842,452 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// Remembers what dirlookup() found: the inode a name in a
+// directory refers to and the offset of its entry, or that
+// the name is absent (inum 0). A directory's cache entries
+// only change while the directory is locked, together with
+// its contents, so they are never stale.
+
+#define NDENTRY 256
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dir;           // inum of the directory; 0 if unused
+  char name[DIRSIZ];
+  uint inum;          // 0 if name is not in dir
+  uint off;           // byte offset of name's dirent in dir
+  struct dentry *hnext;  // hash chain
+  struct dentry *lnext;  // LRU list
+  struct dentry *lprev;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  // Sentinel of the LRU list; lru.lnext is the least recently used.
+  struct dentry lru;
+} dcache;
+
+static int
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return h % NDHASH;
+}
+
+// Move d to the most recently used end of the LRU list,
+// or to the least recently used end if old is set.
+// Caller must hold dcache.lock.
+static void
+dlru(struct dentry *d, int old)
+{
+  struct dentry *at;
+
+  if(d->lnext){
+    d->lprev->lnext = d->lnext;
+    d->lnext->lprev = d->lprev;
+  }
+  at = old ? &dcache.lru : dcache.lru.lprev;
+  d->lprev = at;
+  d->lnext = at->lnext;
+  at->lnext->lprev = d;
+  at->lnext = d;
+}
+
+// Take d out of the hash table. Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+static void
+dcinit(void)
+{
+  int i;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.lnext = &dcache.lru;
+  dcache.lru.lprev = &dcache.lru;
+  for(i = 0; i < NDENTRY; i++)
+    dlru(&dcache.dentry[i], 0);
+}
+
+// Find the cache entry for name in dp.
+// Caller must hold dcache.lock.
+static struct dentry*
+dclookup(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  d = dcache.hash[dhash(dp->dev, dp->inum, name)];
+  for(; d != 0; d = d->hnext){
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Look name up in the cache. If it is there, set *inum
+// and *off and return 1. Caller must hold dp->lock.
+static int
+dcget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dclookup(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  dlru(d, 0);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in dp refers to inode inum, whose
+// dirent is at off, or that name is absent if inum is 0.
+// Caller must hold dp->lock.
+void
+dcput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  int h;
+
+  acquire(&dcache.lock);
+  if((d = dclookup(dp, name)) == 0){
+    d = dcache.lru.lnext;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dir, d->name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dlru(d, 0);
+  release(&dcache.lock);
+}
+
+// Forget everything cached about the directory dp,
+// which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dir == dp->inum && d->dev == dp->dev){
+      dunhash(d);
+      dlru(d, 1);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Read the slot at off of directory dp.
+static void
+dirread(struct inode *dp, void *slot, uint off)
+{
+  if(readi(dp, 0, (uint64)slot, off, sizeof(struct dirent)) != sizeof(struct dirent))
+    panic("dirread");
+}
+
+// Write the slot at off of directory dp.
+// Returns 0 on success, -1 on failure (e.g. out of disk blocks).
+static int
+dirwrite(struct inode *dp, void *slot, uint off)
+{
+  if(writei(dp, 0, (uint64)slot, off, sizeof(struct dirent)) != sizeof(struct dirent))
+    return -1;
+  return 0;
+}
+
+// Search the slots of dp from off up to end for name, or for a
+// free slot if name is 0. Returns the offset of the slot found,
+// leaving it in *de, or -1.
+static int
+dirscan(struct inode *dp, char *name, uint off, uint end, struct dirent *de)
+{
+  for(; off < end; off += sizeof(*de)){
+    dirread(dp, de, off);
+    if(name == 0 && de->inum == 0)
+      return off;
+    if(name != 0 && de->inum != 0 && namecmp(name, de->name) == 0)
+      return off;
+  }
+  return -1;
+}
+
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Is dp an indexed directory?
+static int
+dirindexed(struct inode *dp)
+{
+  struct dirhdr hdr;
+
+  if(dp->size < BSIZE)
+    return 0;
+  dirread(dp, &hdr, DIRHEAD*sizeof(hdr));
+  return hdr.zero == 0 && hdr.magic == DIRMAGIC;
+}
+
+#define LEAFOFF(leaf, i) ((leaf)*BSIZE + (i)*sizeof(struct dirent))
+
+// Return the leaf that bucket b of indexed directory dp maps to.
+static uint
+dirleaf(struct inode *dp, uint b)
+{
+  struct dirslot slot;
+
+  dirread(dp, &slot, LEAFOFF(0, DIRHEAD + 1 + b/DIRSLOTN));
+  return slot.leaf[b%DIRSLOTN];
+}
+
+// Append a new empty leaf of the given depth to dp,
+// and return its block number, or 0 if out of disk blocks.
+static uint
+dirnewleaf(struct inode *dp, int depth)
+{
+  static char zero[BSIZE];
+  struct dirhdr hdr;
+  uint leaf;
+
+  leaf = dp->size / BSIZE;
+  if(writei(dp, 0, (uint64)zero, dp->size, BSIZE) != BSIZE)
+    return 0;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = DIRMAGIC;
+  hdr.depth = depth;
+  if(dirwrite(dp, &hdr, LEAFOFF(leaf, DIRLEAFN)) < 0)
+    return 0;
+  return leaf;
+}
+
+// Turn dp, a directory whose single block is full, into an
+// indexed directory whose every bucket maps to one leaf.
+// Returns 0 on success, -1 on failure.
+static int
+dirindex(struct inode *dp)
+{
+  struct dirent de;
+  struct dirhdr hdr;
+  struct dirslot slot;
+  uint leaf;
+  int i;
+
+  if((leaf = dirnewleaf(dp, 0)) == 0)
+    return -1;
+  for(i = DIRHEAD; i < BSIZE/sizeof(de); i++){
+    dirread(dp, &de, LEAFOFF(0, i));
+    if(dirwrite(dp, &de, LEAFOFF(leaf, i - DIRHEAD)) < 0)
+      return -1;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = DIRMAGIC;
+  if(dirwrite(dp, &hdr, LEAFOFF(0, DIRHEAD)) < 0)
+    return -1;
+  slot.zero = 0;
+  for(i = 0; i < DIRSLOTN; i++)
+    slot.leaf[i] = leaf;
+  for(i = DIRHEAD + 1; i < BSIZE/sizeof(de); i++){
+    if(i > DIRHEAD + (DIRHSIZE - 1)/DIRSLOTN + 1)
+      memset(&slot, 0, sizeof(slot));
+    if(dirwrite(dp, &slot, LEAFOFF(0, i)) < 0)
+      return -1;
+  }
+
+  // The entries moved.
+  dcpurge(dp);
+  return 0;
+}
+
+// Split the full leaf of depth depth that bucket b of dp maps to.
+// Its names whose hash has bit depth set move to a new leaf,
+// and so do the buckets that end in those depth+1 bits.
+// Returns 0 on success, -1 on failure.
+static int
+dirsplit(struct inode *dp, uint b, int depth)
+{
+  struct dirent de, zde;
+  struct dirhdr hdr;
+  struct dirslot slot;
+  uint leaf, nleaf, mask;
+  int i, j, k;
+
+  leaf = dirleaf(dp, b);
+  if((nleaf = dirnewleaf(dp, depth + 1)) == 0)
+    return -1;
+
+  memset(&zde, 0, sizeof(zde));
+  for(i = j = 0; i < DIRLEAFN; i++){
+    dirread(dp, &de, LEAFOFF(leaf, i));
+    if(de.inum == 0 || (dirhash(de.name) >> depth & 1) == 0)
+      continue;
+    if(dirwrite(dp, &de, LEAFOFF(nleaf, j++)) < 0 ||
+       dirwrite(dp, &zde, LEAFOFF(leaf, i)) < 0)
+      return -1;
+  }
+  dirread(dp, &hdr, LEAFOFF(leaf, DIRLEAFN));
+  hdr.depth = depth + 1;
+  if(dirwrite(dp, &hdr, LEAFOFF(leaf, DIRLEAFN)) < 0)
+    return -1;
+
+  mask = (1 << depth) - 1;
+  for(i = 0; i <= (DIRHSIZE - 1)/DIRSLOTN; i++){
+    dirread(dp, &slot, LEAFOFF(0, DIRHEAD + 1 + i));
+    for(k = 0; k < DIRSLOTN; k++){
+      j = i*DIRSLOTN + k;
+      if(j < DIRHSIZE && (j & mask) == (b & mask) && (j >> depth & 1))
+        slot.leaf[k] = nleaf;
+    }
+    if(dirwrite(dp, &slot, LEAFOFF(0, DIRHEAD + 1 + i)) < 0)
+      return -1;
+  }
+
+  // The entries moved.
+  dcpurge(dp);
+  return 0;
+}
+
+// Look up name in indexed directory dp.
+// Returns the offset of its entry, left in *de, or -1.
+static int
+dirhlookup(struct inode *dp, char *name, struct dirent *de)
+{
+  struct dirhdr hdr;
+  uint leaf;
+  int off;
+
+  leaf = dirleaf(dp, dirhash(name) % DIRHSIZE);
+  for(; leaf != 0; leaf = hdr.next){
+    if((off = dirscan(dp, name, LEAFOFF(leaf, 0), LEAFOFF(leaf, DIRLEAFN), de)) >= 0)
+      return off;
+    dirread(dp, &hdr, LEAFOFF(leaf, DIRLEAFN));
+  }
+  return -1;
+}
+
+// Find a free slot for name in indexed directory dp,
+// splitting or extending its leaf if the leaf is full.
+// Returns the slot's offset, or -1 if out of disk blocks.
+static int
+dirhslot(struct inode *dp, char *name)
+{
+  struct dirent de;
+  struct dirhdr hdr;
+  uint h, b, leaf, last;
+  int i, off, n;
+
+  h = dirhash(name);
+  b = h % DIRHSIZE;
+  leaf = dirleaf(dp, b);
+  for(last = leaf; ; last = hdr.next){
+    if((off = dirscan(dp, 0, LEAFOFF(last, 0), LEAFOFF(last, DIRLEAFN), &de)) >= 0)
+      return off;
+    dirread(dp, &hdr, LEAFOFF(last, DIRLEAFN));
+    if(hdr.next == 0)
+      break;
+  }
+
+  // Every leaf on the chain is full. Split the leaf if
+  // it has no overflow chain and name's half would have
+  // room, since a split writes only the leaf, the new
+  // leaf, and the table.
+  if(last == leaf && hdr.depth < DIRHBITS){
+    for(i = n = 0; i < DIRLEAFN; i++){
+      dirread(dp, &de, LEAFOFF(leaf, i));
+      if((dirhash(de.name) >> hdr.depth & 1) == (h >> hdr.depth & 1))
+        n++;
+    }
+    if(n < DIRLEAFN){
+      if(dirsplit(dp, b, hdr.depth) < 0)
+        return -1;
+      leaf = dirleaf(dp, b);
+      return dirscan(dp, 0, LEAFOFF(leaf, 0), LEAFOFF(leaf, DIRLEAFN), &de);
+    }
+  }
+
+  // Otherwise chain an overflow leaf.
+  if((leaf = dirnewleaf(dp, hdr.depth)) == 0)
+    return -1;
+  hdr.next = leaf;
+  if(dirwrite(dp, &hdr, LEAFOFF(last, DIRLEAFN)) < 0)
+    return -1;
+  return LEAFOFF(leaf, 0);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
+  int o;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(dcget(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
   }
 
-  return 0;
+  // an indexed directory's "." and ".." stay at the start
+  // of its first block, in no leaf.
+  if(!dirindexed(dp))
+    o = dirscan(dp, name, 0, dp->size, &de);
+  else if((o = dirscan(dp, name, 0, DIRHEAD*sizeof(de), &de)) < 0)
+    o = dirhlookup(dp, name, &de);
+  if(o < 0){
+    dcput(dp, name, 0, 0);
+    return 0;
+  }
+
+  // entry matches path element
+  if(poff)
+    *poff = o;
+  inum = de.inum;
+  dcput(dp, name, inum, o);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -589,18 +1305,26 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for an empty dirent. When the first block of
+  // a directory fills up, index it.
+  if(dirindexed(dp)){
+    off = dirhslot(dp, name);
+  } else if((off = dirscan(dp, 0, 0, dp->size, &de)) < 0){
+    off = dp->size;
+    if(off == BSIZE){
+      if(dirindex(dp) < 0)
+        return -1;
+      off = dirhslot(dp, name);
+    }
   }
+  if(off < 0)
+    return -1;
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(dirwrite(dp, &de, off) < 0)
     return -1;
+  dcput(dp, name, inum, off);
 
   return 0;
 }
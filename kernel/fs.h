@@ -24,9 +24,11 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NINDIRECT * NDINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +37,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +60,38 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+
+// Indexed directories.
+//
+// A directory whose entries outgrow its first block is turned
+// into an extendible hash table. The first block keeps "." and
+// ".." and then holds a header and a table that maps the low
+// DIRHBITS bits of each name's hash to the directory block (a
+// "leaf") that holds the name. A leaf of depth d holds all the
+// names whose hashes end in the same d bits; a full leaf is
+// split in two, or, if that would not help, given an overflow
+// leaf. Every header and table slot begins with a zero inum,
+// so programs that read a directory as an array of dirents,
+// like ls, see them as free slots.
+#define DIRHBITS 8
+#define DIRHSIZE (1 << DIRHBITS)
+#define DIRMAGIC 0x4844
+#define DIRHEAD 2      // slot of the header in the first block
+#define DIRLEAFN (BSIZE / sizeof(struct dirent) - 1)  // names per leaf
+
+// Index header, or leaf header in a leaf's last slot.
+struct dirhdr {
+  ushort zero;      // always 0
+  ushort magic;     // DIRMAGIC
+  ushort depth;     // leaf: number of hash bits its names share
+  ushort next;      // leaf: overflow leaf, or 0
+  char pad[8];
+};
+
+// Slot of the hash table; the table starts after the header.
+#define DIRSLOTN 7
+
+struct dirslot {
+  ushort zero;      // always 0
+  ushort leaf[DIRSLOTN];
+};
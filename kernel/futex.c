@@ -0,0 +1,135 @@
+//
+// Futexes: wait until a word of user memory changes.
+//
+// futexwait(addr, val) sleeps only if the word at addr still
+// holds val, checked holding the lock of the word's bucket.
+// futexwake() takes the same lock before waking anyone, so
+// a store to the word followed by a wake cannot fall between
+// a waiter's check and its sleep.
+//
+// Waiters sleep on a key naming the word. In a MAP_SHARED
+// mapping the key is the word's physical address, so that
+// processes sharing the page find each other. Elsewhere it
+// is the process and the virtual address, since the word's
+// page moves when a fork() makes it copy-on-write and a
+// thread then stores to it.
+//
+// Lock order: a bucket's lock, then the locks sleep() and
+// wakeup() take.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+
+#define NFUTEX 31
+#define FUTEXLOCK(key) (&futexlock[((key) >> 2) % NFUTEX])
+
+static struct spinlock futexlock[NFUTEX];
+
+extern struct proc proc[NPROC];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+// Return the physical address of the current process's
+// int at va, or 0 if va is not a user address. The page is
+// faulted in writable first, so that it is not shared
+// copy-on-write when futexwait() reads the word.
+static uint64
+futexaddr(uint64 va)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  pte_t *pte;
+
+  if(va % sizeof(int) != 0 || va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0){
+    if(vmfault(pagetable, va, 1) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte) + (va % PGSIZE);
+}
+
+// Return the sleep channel for the word at va, whose
+// physical address is pa. Kernel addresses, which other
+// sleep()s use, are all below MAXVA, and so are physical
+// ones; a private key is above it.
+static uint64
+futexkey(uint64 va, uint64 pa)
+{
+  struct proc *l = myproc()->leader;
+  struct vma *v;
+
+  // another thread can't change the vmas, since mmap() and
+  // munmap() refuse while there are other threads.
+  if((v = vmalookup(l, va, va + 1)) && (v->flags & MAP_SHARED))
+    return pa;
+  return (l - proc + 1) * MAXVA + va;
+}
+
+// If the int at addr holds val, sleep until futexwake() on
+// addr. Returns 0 once woken, -EAGAIN if the word held
+// something else, and -1 if addr is bad or the process has
+// been killed. Like any futex, it may return 0 without
+// the word having changed; callers check it again.
+int
+futexwait(uint64 addr, int val)
+{
+  struct spinlock *lk;
+  uint64 pa, key;
+  pte_t *pte;
+
+  for(;;){
+    if((pa = futexaddr(addr)) == 0)
+      return -1;
+    key = futexkey(addr, pa);
+    lk = FUTEXLOCK(key);
+    acquire(lk);
+    // a thread's store may have moved the page since
+    // futexaddr() looked; if so, the word is elsewhere.
+    pte = walk(myproc()->pagetable, addr, 0);
+    if(pte && (*pte & PTE_V) && PTE2PA(*pte) + addr % PGSIZE == pa)
+      break;
+    release(lk);
+  }
+  if(*(volatile int*)pa != val){
+    release(lk);
+    return -EAGAIN;
+  }
+  sleep((void*)key, lk);
+  release(lk);
+  return killed(myproc()) ? -1 : 0;
+}
+
+// Wake at most n of the processes waiting in futexwait()
+// on addr. Returns how many were woken, or -1 if addr is
+// bad.
+int
+futexwake(uint64 addr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa, key;
+  int r;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  key = futexkey(addr, pa);
+  lk = FUTEXLOCK(key);
+  acquire(lk);
+  r = wakeupn((void*)key, n);
+  release(lk);
+  return r;
+}
@@ -1,6 +1,16 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list, so kalloc() and kfree()
+// normally take only a CPU-local lock. Pages move between
+// the per-CPU lists and a shared pool in batches of KBATCH.
+// A CPU whose list and the pool are both empty steals a
+// batch from another CPU's list.
+//
+// Pages can be shared copy-on-write by several page tables,
+// so each page has a reference count; kfree() drops one
+// reference and only frees the page when the last goes.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +19,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH 32            // pages moved per refill, drain, or steal
+#define KHIWAT (4*KBATCH)    // per-CPU list length that triggers a drain
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,48 +31,154 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+};
+
+struct kmem kmem[NCPU];  // per-CPU free lists
+struct kmem kpool;       // shared pool, refilled by drains
+
+// reference counts, indexed by physical page number.
+// updated with atomic instructions, so need no lock.
+#define PA2REF(pa) (&kref[((uint64)(pa) - KERNBASE) / PGSIZE])
+int kref[(PHYSTOP - KERNBASE) / PGSIZE];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kpool.lock, "kmem_pool");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Push the page r onto km's free list.
+static void
+kpush(struct kmem *km, struct run *r)
+{
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+}
+
+// Detach up to n pages from the front of km's free list.
+// Returns the chain, with its last page in *tail and its
+// length in *np, or 0 if km's list is empty.
+static struct run*
+ktake(struct kmem *km, int n, struct run **tail, int *np)
+{
+  struct run *head, *r;
+  int i;
+
+  acquire(&km->lock);
+  head = km->freelist;
+  if(head == 0){
+    release(&km->lock);
+    return 0;
+  }
+  r = head;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  km->freelist = r->next;
+  km->nfree -= i;
+  release(&km->lock);
+
+  r->next = 0;
+  *tail = r;
+  *np = i;
+  return head;
+}
+
+// Splice the chain head..tail of n pages onto km's free list.
+static void
+kgive(struct kmem *km, struct run *head, struct run *tail, int n)
+{
+  acquire(&km->lock);
+  tail->next = km->freelist;
+  km->freelist = head;
+  km->nfree += n;
+  release(&km->lock);
+}
+
+// Hand out the initial pages round-robin over all CPUs,
+// so that no CPU starts out having to steal.
+// Only called by kinit, before other CPUs are running.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  int id = 0;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    memset(p, 1, PGSIZE);
+    kpush(&kmem[id], (struct run*)p);
+    id = (id + 1) % NCPU;
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, which should have been returned by a call to
+// kalloc(), and free it if that was the last reference.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  int id, n, drain, ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(PA2REF(pa), 1);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  kmem[id].nfree++;
+  drain = kmem[id].nfree > KHIWAT;
+  release(&kmem[id].lock);
+
+  // Too many pages cached on this CPU; return a batch
+  // to the shared pool where other CPUs can refill from it.
+  if(drain && (head = ktake(&kmem[id], KBATCH, &tail, &n)) != 0)
+    kgive(&kpool, head, tail, n);
+
+  pop_off();
+}
+
+// Refill CPU id's empty free list with a batch of pages,
+// from the shared pool if possible, else stolen from
+// another CPU. Returns one page of the batch for the
+// caller, or 0 if there is no free memory anywhere.
+// Interrupts must be off.
+static struct run*
+krefill(int id)
+{
+  struct run *head, *tail;
+  int i, n;
+
+  head = ktake(&kpool, KBATCH, &tail, &n);
+  for(i = 1; head == 0 && i < NCPU; i++)
+    head = ktake(&kmem[(id + i) % NCPU], KBATCH, &tail, &n);
+  if(head && head != tail)
+    kgive(&kmem[id], head->next, tail, n - 1);
+  return head;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +188,58 @@ void *
 kalloc(void)
 {
   struct run *r;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
 
-  if(r)
+  acquire(&kmem[id].lock);
+  r = kmem[id].freelist;
+  if(r){
+    kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
+  release(&kmem[id].lock);
+
+  if(r == 0)
+    r = krefill(id);
+
+  pop_off();
+
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    *PA2REF(r) = 1;
+  }
   return (void*)r;
 }
+
+// Add a reference to the allocated page pa,
+// which is being shared by another page table.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(PA2REF(pa), 1) < 1)
+    panic("kdup: free page");
+}
+
+// Return the number of free pages. The counts are read
+// without their locks, so the answer is only a snapshot.
+int
+knfree(void)
+{
+  int i, n;
+
+  n = kpool.nfree;
+  for(i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;
+  return n;
+}
+
+// Return the number of references to the page pa.
+int
+krefcnt(void *pa)
+{
+  return *(volatile int*)PA2REF(pa);
+}
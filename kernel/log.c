@@ -21,6 +21,13 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// The last outstanding end_op() copies the transaction's
+// blocks aside and lets the next transaction start at
+// once, then writes the copy to the log and installs it.
+// So one transaction can be accumulating while the
+// previous one is being written; a transaction waits to
+// commit only if the one before it is still being written.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,7 +35,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The log blocks go to disk in a single request, and the
+// installs are all started before waiting for any of them.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,13 +50,22 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // copying out a transaction, please wait.
+  int writing;     // in commit(), writing the copy.
   int dev;
   struct logheader lh;
 };
 struct log log;
 
+// The transaction being committed: its header, a private
+// copy of each of its blocks, and the cached buffers they
+// were copied from, which stay pinned until installed.
+static struct logheader clh;
+static struct buf logbuf[LOGSIZE];
+static struct buf *logcached[LOGSIZE];
+
 static void recover_from_log(void);
+static void copy_trans(void);
 static void commit();
 
 void
@@ -65,8 +82,9 @@ initlog(int dev, struct superblock *sb)
 }
 
 // Copy committed blocks from log to their home location
+// after a crash.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
   int tail;
 
@@ -75,8 +93,6 @@ install_trans(int recovering)
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -96,18 +112,18 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write in-memory log header lh to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,9 +133,9 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -152,7 +168,7 @@ end_op(void)
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && log.lh.n > 0){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -164,41 +180,98 @@ end_op(void)
   release(&log.lock);
 
   if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
+    // the previous transaction must be out of logbuf[]
+    // and the on-disk log before this one can use them.
+    acquire(&log.lock);
+    while(log.writing)
+      sleep(&log, &log.lock);
+    log.writing = 1;
+    release(&log.lock);
+
+    // copy the transaction out w/o holding locks, since
+    // bread() may sleep. no FS system calls are active.
+    copy_trans();
+
     acquire(&log.lock);
+    log.lh.n = 0;
     log.committing = 0;
     wakeup(&log);
     release(&log.lock);
+
+    // the next transaction can start while this is written.
+    commit();
+
+    acquire(&log.lock);
+    log.writing = 0;
+    wakeup(&log);
+    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the header and modified blocks of the finished
+// transaction from log.lh and the cache to clh and logbuf[].
 static void
-write_log(void)
+copy_trans(void)
 {
   int tail;
 
+  clh.n = log.lh.n;
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    clh.block[tail] = log.lh.block[tail];
+    memmove(logbuf[tail].data, from->data, BSIZE);
+    logcached[tail] = from;  // still pinned by log_write()
     brelse(from);
-    brelse(to);
   }
 }
 
+// Copy modified blocks from logbuf[] to the log,
+// as one multi-block disk request.
+static void
+write_log(void)
+{
+  struct buf *bp[LOGSIZE];
+  int tail;
+
+  for (tail = 0; tail < clh.n; tail++) {
+    logbuf[tail].dev = log.dev;
+    logbuf[tail].blockno = log.start+tail+1; // log block
+    bp[tail] = &logbuf[tail];
+  }
+  virtio_disk_start(bp, clh.n, 1);
+  for (tail = 0; tail < clh.n; tail++)
+    virtio_disk_wait(bp[tail]);
+}
+
+// Copy committed blocks from logbuf[] to their home
+// locations, with all the writes in flight at once.
+// Then the cached copies no longer need to stay pinned.
+static void
+install_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < clh.n; tail++) {
+    logbuf[tail].blockno = clh.block[tail]; // dst
+    struct buf *b = &logbuf[tail];
+    virtio_disk_start(&b, 1, 1);
+  }
+  for (tail = 0; tail < clh.n; tail++) {
+    virtio_disk_wait(&logbuf[tail]);
+    bunpin(logcached[tail]);
+  }
+}
+
+// Write the copied-out transaction to disk.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  if (clh.n > 0) {
+    write_log();       // Write modified blocks from logbuf to log
+    write_head(&clh);  // Write header to disk -- the real commit
+    install_log();     // Now install writes to home locations
+    clh.n = 0;
+    write_head(&clh);  // Erase the transaction from the log
   }
 }
 
@@ -62,6 +62,13 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed regions, below USERTOP
+//   trapframes of a process's other threads
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// the trapframe of thread slot i of a process whose
+// threads share a page table; slot 0 is the main thread.
+#define THREADFRAME(i) (TRAPFRAME - (i)*PGSIZE)
+#define USERTOP THREADFRAME(NTHREAD)
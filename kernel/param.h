@@ -1,13 +1,18 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NTHREAD      16  // maximum threads per process
+#define NOFILE       64  // open files per process
+#define NFILE       200  // open files per system
+#define NVMA         16  // file-backed memory regions per process
+#define NINODE      500  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*6)  // size of disk block cache
+#define NREADAHEAD   16  // max blocks read ahead of a sequential reader
+#ifndef FSSIZE
+#define FSSIZE       10000  // size of file system in blocks (make FSSIZE=n)
+#endif
 #define MAXPATH      128   // maximum file path name
@@ -7,18 +7,69 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// A pipe's data lives in a ring of npages pages, a power
+// of two, so that the byte counts can wrap around.
+#define PIPEPAGES 4       // default size
+#define PIPEMAXPAGES 64   // largest size F_SETPIPE_SZ allows
+
+// lock protects the counts and the open flags. wlock serializes
+// writers and rlock readers, so that splice can move data into
+// or out of the ring without holding lock across disk I/O.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  struct sleeplock wlock;
+  struct sleeplock rlock;
+  char *page[PIPEMAXPAGES];
+  uint npages;
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollq poll;  // poll()s waiting on either end
 };
 
+#define PIPESIZE(pi) ((pi)->npages * PGSIZE)
+
+// Wake processes sleeping on chan, and any poll()ing
+// pi. Called with pi->lock held.
+static void
+pipewakeup(struct pipe *pi, void *chan)
+{
+  wakeup(chan);
+  pollwakeup(&pi->poll);
+}
+
+// Allocate n pages into page[]. Returns 0, or
+// -1 (having freed any it got) if out of memory.
+static int
+pagealloc(char **page, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if((page[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(page[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+pagefree(char **page, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    kfree(page[i]);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,11 +81,20 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if(pagealloc(pi->page, PIPEPAGES) < 0){
+    kfree((char*)pi);
+    pi = 0;
+    goto bad;
+  }
+  pi->npages = PIPEPAGES;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->poll.head = 0;
+  initlock_noreg(&pi->lock, "pipe");
+  initsleeplock(&pi->wlock, "pipew");
+  initsleeplock(&pi->rlock, "piper");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -46,8 +106,10 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    pagefree(pi->page, pi->npages);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -55,76 +117,329 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Return the size of pi's buffer in bytes.
+int
+pipesize(struct pipe *pi)
+{
+  int n;
+
+  acquire(&pi->lock);
+  n = PIPESIZE(pi);
+  release(&pi->lock);
+  return n;
+}
+
+// Resize pi's buffer to hold at least n bytes, rounding
+// up to a power of two pages. Returns the new size, or -1
+// if n is too big or smaller than the data in the pipe.
+int
+piperesize(struct pipe *pi, int n)
+{
+  char *page[PIPEMAXPAGES], *old[PIPEMAXPAGES];
+  uint npages, nold, i, m, off;
+
+  if(n < 0 || n > PIPEMAXPAGES * PGSIZE)
+    return -1;
+  for(npages = 1; npages * PGSIZE < n; npages *= 2)
+    ;
+  if(pagealloc(page, npages) < 0)
+    return -1;
+
+  if(acquiresleepkillable(&pi->wlock) < 0){
+    pagefree(page, npages);
+    return -1;
+  }
+  if(acquiresleepkillable(&pi->rlock) < 0){
+    releasesleep(&pi->wlock);
+    pagefree(page, npages);
+    return -1;
+  }
+  acquire(&pi->lock);
+  if(pi->nwrite - pi->nread > npages * PGSIZE){
+    release(&pi->lock);
+    releasesleep(&pi->rlock);
+    releasesleep(&pi->wlock);
+    pagefree(page, npages);
+    return -1;
+  }
+  // Copy the data to the start of the new ring.
+  for(i = 0; pi->nread + i != pi->nwrite; i += m){
+    off = (pi->nread + i) % PIPESIZE(pi);
+    m = min(pi->nwrite - pi->nread - i,
+            min(PGSIZE - off % PGSIZE, PGSIZE - i % PGSIZE));
+    memmove(page[i / PGSIZE] + i % PGSIZE, pi->page[off / PGSIZE] + off % PGSIZE, m);
+  }
+  nold = pi->npages;
+  memmove(old, pi->page, nold * sizeof(old[0]));
+  memmove(pi->page, page, npages * sizeof(page[0]));
+  pi->npages = npages;
+  pi->nread = 0;
+  pi->nwrite = i;
+  pipewakeup(pi, &pi->nwrite);
+  release(&pi->lock);
+  releasesleep(&pi->rlock);
+  releasesleep(&pi->wlock);
+
+  pagefree(old, nold);
+  return npages * PGSIZE;
+}
+
+// Return the poll() events the read end (or, if writable,
+// the write end) of pi is ready for. If pe is not 0, put
+// it on pi's poll queue.
+int
+pipepoll(struct pipe *pi, int writable, struct pollent *pe)
+{
+  int ev = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      ev |= POLLERR;
+    else if(pi->nwrite != pi->nread + PIPESIZE(pi))
+      ev |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      ev |= POLLIN;
+    if(pi->writeopen == 0)
+      ev |= POLLHUP;
+  }
+  if(pe)
+    pollwait(pe, &pi->poll, &pi->lock);
+  release(&pi->lock);
+  return ev;
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
-    wakeup(&pi->nread);
+    pipewakeup(pi, &pi->nread);
   } else {
     pi->readopen = 0;
-    wakeup(&pi->nwrite);
+    pipewakeup(pi, &pi->nwrite);
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    pagefree(pi->page, pi->npages);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Acquire lk, waiting for another reader or writer to
+// finish. Returns 0, -EAGAIN if nonblock and lk is held,
+// or -1 if the process is killed while waiting.
+static int
+pipelock(struct sleeplock *lk, int nonblock)
+{
+  if(nonblock)
+    return tryacquiresleep(lk) ? 0 : -EAGAIN;
+  return acquiresleepkillable(lk);
+}
+
+// Write the n user buffers iov[] to pi. If nonblock,
+// write only what fits without waiting.
+int
+pipewrite(struct pipe *pi, struct iovec *iov, int n, int nonblock)
+{
+  int i = 0, k;
+  uint64 addr, done;
+  uint off, m;
+  struct proc *pr = myproc();
+
+  if((i = pipelock(&pi->wlock, nonblock)) < 0)
+    return i;
+  acquire(&pi->lock);
+  for(k = 0; k < n; k++){
+    addr = (uint64)iov[k].iov_base;
+    for(done = 0; done < iov[k].iov_len; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        releasesleep(&pi->wlock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE(pi)){ //DOC: pipewrite-full
+        if(nonblock){
+          if(i == 0)
+            i = -EAGAIN;
+          goto out;
+        }
+        pipewakeup(pi, &pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+        continue;
+      }
+      // copy as much as fits before the end of a page.
+      off = pi->nwrite % PIPESIZE(pi);
+      m = min(iov[k].iov_len - done, pi->nread + PIPESIZE(pi) - pi->nwrite);
+      m = min(m, PGSIZE - off % PGSIZE);
+      if(copyin(pr->pagetable, pi->page[off / PGSIZE] + off % PGSIZE, addr + done, m) == -1)
+        goto out;
+      pi->nwrite += m;
+      done += m;
+      i += m;
+    }
+  }
+ out:
+  pipewakeup(pi, &pi->nread);
+  release(&pi->lock);
+  releasesleep(&pi->wlock);
+
+  return i;
+}
+
+// Read from pi into the n user buffers iov[]. If
+// nonblock, fail rather than wait for data.
+int
+piperead(struct pipe *pi, struct iovec *iov, int n, int nonblock)
+{
+  int i = 0, k;
+  uint64 addr, done;
+  uint off, m;
+  struct proc *pr = myproc();
+
+  if((i = pipelock(&pi->rlock, nonblock)) < 0)
+    return i;
+  acquire(&pi->lock);
+  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+    if(killed(pr) || nonblock){
+      release(&pi->lock);
+      releasesleep(&pi->rlock);
+      return killed(pr) ? -1 : -EAGAIN;
+    }
+    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+  }
+  for(k = 0; k < n; k++){  //DOC: piperead-copy
+    addr = (uint64)iov[k].iov_base;
+    for(done = 0; done < iov[k].iov_len; done += m){
+      if(pi->nread == pi->nwrite)
+        goto out;
+      off = pi->nread % PIPESIZE(pi);
+      m = min(iov[k].iov_len - done, pi->nwrite - pi->nread);
+      m = min(m, PGSIZE - off % PGSIZE);
+      if(copyout(pr->pagetable, addr + done, pi->page[off / PGSIZE] + off % PGSIZE, m) == -1)
+        goto out;
+      pi->nread += m;
+      i += m;
+    }
+  }
+ out:
+  pipewakeup(pi, &pi->nwrite);  //DOC: piperead-wakeup
+  release(&pi->lock);
+  releasesleep(&pi->rlock);
+  return i;
+}
+
+// Move up to n bytes from inode file f into pi, reading
+// them straight into the ring, without a copy through user
+// space. Like pipewrite(), waits for room until all n bytes
+// are moved, unless f runs out first; if nonblock, moves
+// only what fits.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipefromfile(struct pipe *pi, struct file *f, int n, int nonblock)
 {
-  int i = 0;
+  int i, r;
+  uint off, m;
+  char *dst;
   struct proc *pr = myproc();
 
+  if((i = pipelock(&pi->wlock, nonblock)) < 0)
+    return i;
   acquire(&pi->lock);
-  while(i < n){
+  for(i = 0; i < n; i += r){
     if(pi->readopen == 0 || killed(pr)){
       release(&pi->lock);
+      releasesleep(&pi->wlock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    if(pi->nwrite == pi->nread + PIPESIZE(pi)){
+      if(nonblock){
+        if(i == 0)
+          i = -EAGAIN;
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      }
+      pipewakeup(pi, &pi->nread);
+      sleep(&pi->nwrite, &pi->lock);
+      r = 0;
+      continue;
     }
+    off = pi->nwrite % PIPESIZE(pi);
+    m = min(n - i, pi->nread + PIPESIZE(pi) - pi->nwrite);
+    m = min(m, PGSIZE - off % PGSIZE);
+    dst = pi->page[off / PGSIZE] + off % PGSIZE;
+    release(&pi->lock);
+
+    // holding wlock, this is the only writer of the
+    // ring's free space.
+    ilock(f->ip);
+    if((r = readi(f->ip, 0, (uint64)dst, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+
+    acquire(&pi->lock);
+    if(r <= 0)
+      break;
+    pi->nwrite += r;
+    pipewakeup(pi, &pi->nread);
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
+  releasesleep(&pi->wlock);
 
   return i;
 }
 
+// Move up to n bytes from pi to inode file f, writing them
+// straight from the ring. Like piperead(), waits for data
+// only if the pipe is empty, and fails instead if nonblock.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipetofile(struct pipe *pi, struct file *f, int n, int nonblock)
 {
-  int i;
+  int i, r;
+  uint off, m;
+  char *src;
   struct proc *pr = myproc();
-  char ch;
 
+  if((i = pipelock(&pi->rlock, nonblock)) < 0)
+    return i;
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(killed(pr)){
+  while(pi->nread == pi->nwrite && pi->writeopen){
+    if(killed(pr) || nonblock){
       release(&pi->lock);
-      return -1;
+      releasesleep(&pi->rlock);
+      return killed(pr) ? -1 : -EAGAIN;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    sleep(&pi->nread, &pi->lock);
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += r){
+    off = pi->nread % PIPESIZE(pi);
+    m = min(n - i, pi->nwrite - pi->nread);
+    m = min(m, PGSIZE - off % PGSIZE);
+    // as in filewrite(), keep each transaction small.
+    m = min(m, writemax(f->off));
+    src = pi->page[off / PGSIZE] + off % PGSIZE;
+    release(&pi->lock);
+
+    // holding rlock, this is the only reader of the
+    // ring's data.
+    begin_op();
+    ilock(f->ip);
+    if((r = writei(f->ip, 0, (uint64)src, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_op();
+
+    acquire(&pi->lock);
+    if(r <= 0)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    pi->nread += r;
+    pipewakeup(pi, &pi->nwrite);
+    if(r != m)
       break;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
+  releasesleep(&pi->rlock);
+
   return i;
 }
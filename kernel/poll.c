@@ -0,0 +1,181 @@
+//
+// poll(): wait for any of several files to become ready.
+//
+// Each object a process can block on (a pipe, the console)
+// has a pollq, protected by the object's own lock. poll()
+// puts a pollent for each of its files on the file's object's
+// queue, and then sleeps on its polltable. When an object's
+// state changes, pollwakeup() marks every polltable on its
+// queue triggered and wakes its poller, which looks at all
+// its files again.
+//
+// Lock order: the object's lock, then pt->lock, then the
+// locks sleep() and wakeup() take.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+
+// A poll() in progress; kalloc()ed, since it is too big
+// for the kernel stack.
+struct polltable {
+  struct spinlock lock;
+  int triggered;                // an object changed since the last scan
+  struct pollent ent[NOFILE];   // one per fd
+  struct pollent tick;          // on tickpoll, if there is a timeout
+};
+
+// poll()s with a timeout, woken by every clock tick.
+// Protected by tickslock.
+static struct pollq tickpoll;
+
+// Put pe on q, the queue of an object whose lock lk
+// the caller holds.
+void
+pollwait(struct pollent *pe, struct pollq *q, struct spinlock *lk)
+{
+  pe->q = q;
+  pe->lk = lk;
+  pe->prev = 0;
+  pe->next = q->head;
+  if(q->head)
+    q->head->prev = pe;
+  q->head = pe;
+}
+
+static void
+pollremove(struct pollent *pe)
+{
+  acquire(pe->lk);
+  if(pe->prev)
+    pe->prev->next = pe->next;
+  else
+    pe->q->head = pe->next;
+  if(pe->next)
+    pe->next->prev = pe->prev;
+  release(pe->lk);
+  pe->q = 0;
+}
+
+// The object whose queue q is may have become ready;
+// wake everyone poll()ing it. The caller holds the
+// object's lock.
+void
+pollwakeup(struct pollq *q)
+{
+  struct pollent *pe;
+
+  for(pe = q->head; pe; pe = pe->next){
+    acquire(&pe->pt->lock);
+    pe->pt->triggered = 1;
+    wakeup(pe->pt);
+    release(&pe->pt->lock);
+  }
+}
+
+// Called by clockintr() with tickslock held.
+void
+polltick(void)
+{
+  pollwakeup(&tickpoll);
+}
+
+// Wait until one of the n files in fds[] is ready for an
+// event it asks for, or for timeout ticks (forever if timeout
+// is negative). Sets each revents and returns the number of
+// fds with events, or -1.
+int
+poll(struct pollfd *fds, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct polltable *pt;
+  struct file *f[NOFILE];
+  int i, ev, ready;
+  uint t0;
+
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if((pt = (struct polltable*)kalloc()) == 0)
+    return -1;
+  initlock_noreg(&pt->lock, "poll");
+  pt->triggered = 0;
+
+  // hold a reference to each file, so that none can be
+  // freed while one of pt's entries is on its queue.
+  acquire(&p->leader->fdlock);
+  for(i = 0; i < n; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && p->leader->ofile[fds[i].fd])
+      f[i] = filedup(p->leader->ofile[fds[i].fd]);
+    pt->ent[i].pt = pt;
+    pt->ent[i].q = 0;
+  }
+  release(&p->leader->fdlock);
+  pt->tick.pt = pt;
+  pt->tick.q = 0;
+
+  acquire(&tickslock);
+  t0 = ticks;
+  if(timeout > 0)
+    pollwait(&pt->tick, &tickpoll, &tickslock);
+  release(&tickslock);
+
+  for(;;){
+    acquire(&pt->lock);
+    pt->triggered = 0;
+    release(&pt->lock);
+
+    // look at every file, joining the queues of those
+    // not yet joined.
+    ready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(f[i] == 0)
+        ev = POLLNVAL;
+      else
+        ev = filepoll(f[i], timeout != 0 && pt->ent[i].q == 0 ? &pt->ent[i] : 0);
+      fds[i].revents = ev & (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+      if(fds[i].revents)
+        ready++;
+    }
+    if(ready || timeout == 0)
+      break;
+    acquire(&tickslock);
+    ev = timeout > 0 && ticks - t0 >= timeout;
+    release(&tickslock);
+    if(ev)
+      break;
+    if(killed(p)){
+      ready = -1;
+      break;
+    }
+
+    // an object that became ready after the scan
+    // set triggered.
+    acquire(&pt->lock);
+    while(pt->triggered == 0 && !killed(p))
+      sleep(pt, &pt->lock);
+    release(&pt->lock);
+  }
+
+  for(i = 0; i < n; i++){
+    if(pt->ent[i].q)
+      pollremove(&pt->ent[i]);
+    if(f[i])
+      fileclose(f[i]);
+  }
+  if(pt->tick.q)
+    pollremove(&pt->tick);
+  kfree((char*)pt);
+  return ready;
+}
@@ -0,0 +1,12 @@
+// poll() events.
+#define POLLIN   0x001  // there is data to read
+#define POLLOUT  0x004  // there is room to write
+#define POLLERR  0x008  // a pipe's read end has been closed
+#define POLLHUP  0x010  // a pipe's write end has been closed
+#define POLLNVAL 0x020  // fd is not open
+
+struct pollfd {
+  int fd;         // file descriptor; ignored if negative
+  short events;   // events asked for
+  short revents;  // events that happened
+};
@@ -12,11 +12,37 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Per-CPU queues of RUNNABLE processes. A process is on
+// exactly one run queue when, and only when, it is RUNNABLE.
+// Enqueue with p->lock held; p->lock is acquired before
+// a run queue's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  volatile int n;      // Number of processes on the queue
+  int online;          // Has this CPU entered scheduler()?
+} runq[NCPU];
+
+// Processes in sleep(), hashed by channel, so that wakeup()
+// need look only at those that might be sleeping on its
+// channel. A process joins its channel's queue in sleep()
+// and leaves it again after it wakes up. A wait queue's
+// lock is acquired before any p->lock.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void killlocked(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -51,8 +77,14 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->vmlock, "vm");
+      initlock(&p->fdlock, "fd");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
@@ -89,6 +121,92 @@ myproc(void)
   return p;
 }
 
+// Make p RUNNABLE and put it at the tail of cpu's run queue.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p, int cpu)
+{
+  struct runq *rq = &runq[cpu];
+
+  p->state = RUNNABLE;
+  p->cpu = cpu;
+  p->rqnext = 0;
+  acquire(&rq->lock);
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Take the process at the head of cpu's run queue, or
+// return 0 if it is empty. The process stays RUNNABLE,
+// and the caller should acquire its lock to run it.
+static struct proc*
+rqpop(int cpu)
+{
+  struct runq *rq = &runq[cpu];
+  struct proc *p;
+
+  if(rq->n == 0)
+    return 0;
+  acquire(&rq->lock);
+  if((p = rq->head) != 0){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Steal a process from the busiest other CPU's run queue.
+static struct proc*
+rqsteal(int cpu)
+{
+  int i, n, max, victim;
+
+  max = 0;
+  victim = -1;
+  for(i = 0; i < NCPU; i++){
+    n = runq[i].n;
+    if(i != cpu && n > max){
+      max = n;
+      victim = i;
+    }
+  }
+  if(victim < 0)
+    return 0;
+  return rqpop(victim);
+}
+
+// The CPU a new process should start on: the one with
+// the fewest processes running or waiting to run.
+static int
+rqpick(void)
+{
+  int i, id, load, best, bestload;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  best = id;
+  bestload = runq[id].n + (cpus[id].proc != 0);
+  for(i = 0; i < NCPU; i++){
+    if(!runq[i].online)
+      continue;
+    load = runq[i].n + (cpus[i].proc != 0);
+    if(load < bestload){
+      best = i;
+      bestload = load;
+    }
+  }
+  return best;
+}
+
 int
 allocpid()
 {
@@ -104,10 +222,11 @@ allocpid()
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. A thread gets no page table;
+// clone() gives it the process's.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int thread)
 {
   struct proc *p;
 
@@ -133,11 +252,16 @@ found:
   }
 
   // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
+  if(!thread){
+    p->leader = p;
+    p->tslots = 1;
+    p->tfva = TRAPFRAME;
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
   }
 
   // Set up new context to start executing at forkret,
@@ -150,20 +274,34 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages, unless p is a thread, whose pages
+// belong to its main thread.
+// p->lock must be held, and wait_lock too if p is a thread.
 static void
 freeproc(struct proc *p)
 {
+  struct proc *l = p->leader;
+
+  if(l && l != p){
+    // give back the thread's trapframe slot.
+    acquire(&l->vmlock);
+    uvmunmap(p->pagetable, p->tfva, 1, 0);
+    l->tslots &= ~(1 << (TRAPFRAME - p->tfva) / PGSIZE);
+    release(&l->vmlock);
+  } else if(p->pagetable)
+    proc_freepagetable(p->pagetable, p->sz);
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
+  p->tfva = 0;
+  p->ustack = 0;
+  p->nfdheld = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
+  p->leader = 0;
+  p->tslots = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -234,7 +372,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
@@ -249,29 +387,43 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p, 0);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct proc *l = p->leader;
 
-  sz = p->sz;
+  acquire(&l->vmlock);
+  oldsz = sz = l->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
-      return -1;
-    }
+    // don't allocate memory yet; vmfault() maps each
+    // page when it is first touched. but refuse to grow
+    // by more than is free now, so that sbrk() fails
+    // rather than a later page fault when memory is short.
+    if(sz + n > USERTOP || vmalookup(l, PGROUNDUP(sz), sz + n) ||
+       PGROUNDUP(sz + n) - PGROUNDUP(sz) > (uint64)knfree() * PGSIZE)
+      oldsz = -1;
+    else
+      sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // another thread on another CPU could go on using a
+    // freed page through a stale TLB entry.
+    if(l->tslots != 1)
+      oldsz = -1;
+    else
+      sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  l->sz = sz;
+  release(&l->vmlock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -284,17 +436,32 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. That makes the
+  // parent's writable pages read-only, and another thread
+  // running on another CPU could go on writing to one of
+  // them, now shared with the child, through a stale TLB
+  // entry. So, like exec(), refuse while there are other
+  // threads.
+  acquire(&p->leader->vmlock);
+  if(p->leader->tslots != 1 ||
+     uvmcopy(p->pagetable, np->pagetable, p->leader->sz) < 0){
+    release(&p->leader->vmlock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->sz = p->leader->sz;
+  if(vmacopy(p->leader, np) < 0){
+    release(&p->leader->vmlock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  release(&p->leader->vmlock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -303,9 +470,11 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->leader->fdlock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+    if(p->leader->ofile[i])
+      np->ofile[i] = filedup(p->leader->ofile[i]);
+  release(&p->leader->fdlock);
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
@@ -319,7 +488,73 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np, rqpick());
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread of the current process. It shares the
+// process's page table, and so its memory, and its open
+// files, and starts in fn(arg) on the user stack whose top
+// is stack. It gets its own reference to the current
+// directory. Returns the new thread's pid.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid, k;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *l = p->leader;
+
+  if(stack % 16 != 0)
+    return -1;
+  if((np = allocproc(1)) == 0)
+    return -1;
+  release(&np->lock);
+
+  // map np's trapframe at a free slot below the
+  // main thread's.
+  acquire(&wait_lock);
+  acquire(&l->vmlock);
+  for(i = 1; i < NTHREAD; i++)
+    if((l->tslots & (1 << i)) == 0)
+      break;
+  if(i == NTHREAD || mappages(p->pagetable, THREADFRAME(i), PGSIZE,
+                              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    release(&l->vmlock);
+    release(&wait_lock);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  l->tslots |= 1 << i;
+  release(&l->vmlock);
+  np->pagetable = p->pagetable;
+  np->tfva = THREADFRAME(i);
+  np->leader = l;
+  np->parent = p;
+  // if the main thread is exiting, it has killed p,
+  // and may have missed np.
+  k = killed(p);
+  release(&wait_lock);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+  np->ustack = stack;
+
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  acquire(&np->lock);
+  np->killed = k;
+  setrunnable(np, rqpick());
   release(&np->lock);
 
   return pid;
@@ -347,10 +582,29 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct proc *pp;
 
   if(p == initproc)
     panic("init exiting");
 
+  // a main thread's other threads use its memory, so
+  // they must go first. kill them, and wait for whoever
+  // reaps them: their parents, or init.
+  acquire(&wait_lock);
+  if(p->leader == p && p->tslots != 1){
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp != p && pp->leader == p){
+        acquire(&pp->lock);
+        killlocked(pp);
+        release(&pp->lock);
+      }
+    }
+    reparent(p);
+    while(p->tslots != 1)
+      sleep(&p->tslots, &wait_lock);
+  }
+  release(&wait_lock);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -359,6 +613,8 @@ exit(int status)
       p->ofile[fd] = 0;
     }
   }
+  if(p->leader == p)
+    vmaclear(p->pagetable, p->vma);
 
   begin_op();
   iput(p->cwd);
@@ -385,22 +641,29 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit and return its pid. If thread,
+// wait only for threads made by clone(), and copy out the
+// stack each was given to addr; otherwise wait for any
+// child, and copy out its exit status.
+// Return -1 if this process has no such children.
+static int
+reap(uint64 addr, int thread)
 {
-  struct proc *pp;
+  struct proc *pp, *l;
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the result is copied out with wait_lock held.
+  if(addr != 0)
+    vmprefault(addr, sizeof(uint64));
+
   acquire(&wait_lock);
 
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+      if(pp->parent == p && (!thread || pp->leader != pp)){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -408,14 +671,19 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
+          if(addr != 0 && copyout(p->pagetable, addr,
+                                  thread ? (char *)&pp->ustack : (char *)&pp->xstate,
+                                  thread ? sizeof(pp->ustack) : sizeof(pp->xstate)) < 0) {
             release(&pp->lock);
             release(&wait_lock);
             return -1;
           }
+          l = pp->leader;
           freeproc(pp);
           release(&pp->lock);
+          // a main thread waits in exit() for its threads.
+          if(l != pp)
+            wakeup(&l->tslots);
           release(&wait_lock);
           return pid;
         }
@@ -434,10 +702,27 @@ wait(uint64 addr)
   }
 }
 
+// Wait for a child process or thread to exit and
+// return its pid.
+int
+wait(uint64 addr)
+{
+  return reap(addr, 0);
+}
+
+// Wait for a thread made by clone() to exit and return
+// its pid. The stack it was given is stored at addr.
+int
+join(uint64 addr)
+{
+  return reap(addr, 1);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the next process from this CPU's run queue,
+//    or steal one from another CPU's if it is empty.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,28 +731,32 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
+  runq[id].online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
-    }
+    if((p = rqpop(id)) == 0 && (p = rqsteal(id)) == 0)
+      continue;
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -504,7 +793,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p, p->cpu);
   sched();
   release(&p->lock);
 }
@@ -536,28 +825,47 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once we hold p->lock, and are on chan's
+  // wait queue, we can be guaranteed that we
+  // won't miss any wakeup (wakeup locks the
+  // wait queue and then p->lock),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
-  release(lk);
 
-  // Go to sleep.
+  // Go to sleep. Join the wait queue before releasing
+  // lk, since wakeup() skips a queue that looks empty.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqprev = 0;
+  p->wqnext = wq->head;
+  if(wq->head)
+    wq->head->wqprev = p;
+  wq->head = p;
+  release(lk);
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  acquire(&wq->lock);
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    wq->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -566,17 +874,35 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  wakeupn(chan, NPROC);
+}
+
+// Wake up at most n of the processes sleeping on chan,
+// and return how many were woken.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
+{
+  struct waitq *wq = WAITQ(chan);
   struct proc *p;
+  int woken;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  woken = 0;
+  if(wq->head == 0 || n <= 0)
+    return 0;
+  acquire(&wq->lock);
+  for(p = wq->head; p && woken < n; p = p->wqnext) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p, p->cpu);
+        woken++;
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
+  return woken;
 }
 
 // Kill the process with the given pid.
@@ -590,11 +916,7 @@ kill(int pid)
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
+      killlocked(p);
       release(&p->lock);
       return 0;
     }
@@ -603,6 +925,17 @@ kill(int pid)
   return -1;
 }
 
+// Kill p, which the caller has locked.
+static void
+killlocked(struct proc *p)
+{
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p, p->cpu);
+  }
+}
+
 void
 setkilled(struct proc *p)
 {
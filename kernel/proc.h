@@ -79,6 +79,20 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory whose pages are read in from
+// a file the first time they are touched; see vmfault().
+struct vma {
+  uint64 start;                // First address, page-aligned
+  uint64 end;                  // One past the last address
+  int perm;                    // PTE permission bits for its pages
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, and VMA_EXEC
+  struct inode *ip;            // Backing file; 0 if the slot is free
+  uint off;                    // File offset of start
+  uint filesz;                 // Bytes backed by the file; the rest are zero
+};
+
+#define VMA_EXEC 0x100         // a segment of the program exec() loaded
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,17 +105,40 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue it last joined
+
+  // runq[cpu].lock must be held when using this:
+  struct proc *rqnext;         // Next on the run queue
 
-  // wait_lock must be held when using this:
+  // the lock of chan's wait queue must be held when using these:
+  struct proc *wqnext;         // Next sleeper on the wait queue
+  struct proc *wqprev;         // Previous sleeper on the wait queue
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *leader;         // Main thread; p itself unless p is a thread
+  uint tslots;                 // In a main thread: bit i set if THREADFRAME(i) is in use
+
+  // Threads share their main thread's page table, sz and vma[],
+  // and use leader->vmlock to serialize changes to the page table.
+  struct spinlock vmlock;
+
+  // Threads also share their main thread's ofile[], which
+  // leader->fdlock protects.
+  struct spinlock fdlock;
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // User address of trapframe
+  uint64 ustack;               // Stack clone() was given
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file *ofile[NOFILE];  // Open files; a thread's are in leader->ofile
+  struct file *fdheld[2];      // References argfd() took for this system call
+  int nfdheld;
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // File-backed memory regions
   char name[16];               // Process name (debugging)
 };
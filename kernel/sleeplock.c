@@ -9,10 +9,13 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// lk->lk is held only for a few instructions at a time, so
+// it is left out of lockstat(); that also lets sleep locks
+// live in memory that is later freed, as a pipe's do.
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
-  initlock(&lk->lk, "sleep lock");
+  initlock_noreg(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
@@ -30,6 +33,41 @@ acquiresleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Like acquiresleep(), but give up if the process is
+// killed while waiting. Returns 0 if it got lk, -1 if not.
+int
+acquiresleepkillable(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked) {
+    if(killed(myproc())){
+      release(&lk->lk);
+      return -1;
+    }
+    sleep(lk, &lk->lk);
+  }
+  lk->locked = 1;
+  lk->pid = myproc()->pid;
+  release(&lk->lk);
+  return 0;
+}
+
+// Acquire lk if no one holds it. Returns 1 if it did.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  release(&lk->lk);
+  return r;
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
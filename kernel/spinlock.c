@@ -8,12 +8,45 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every lock passed to initlock() is kept on a list, so
+// that lockstat() can report how often each kind of lock
+// is acquired and contended. The list is for locks that
+// live as long as the kernel, in memory that starts out
+// zeroed. Short-lived locks, such as a pipe's, use
+// initlock_noreg() instead, so that making one doesn't
+// take lock_locks and freeing one needs no unlinking.
+static struct spinlock *locks;
+static struct spinlock lock_locks;
+
+// Initialize lk without recording it for lockstat().
 void
-initlock(struct spinlock *lk, char *name)
+initlock_noreg(struct spinlock *lk, char *name)
 {
   lk->name = name;
+#ifdef TICKETLOCK
+  lk->next = lk->owner = 0;
+#else
   lk->locked = 0;
+#endif
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->nextlock = lk->prevlock = 0;
+}
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  acquire(&lock_locks);
+  // relinking a lock that is on the list would corrupt it.
+  if(lk->prevlock || locks == lk)
+    panic("initlock");
+  initlock_noreg(lk, name);
+  lk->nextlock = locks;
+  if(locks)
+    locks->prevlock = lk;
+  locks = lk;
+  release(&lock_locks);
 }
 
 // Acquire the lock.
@@ -21,16 +54,33 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint spins;
+#ifdef TICKETLOCK
+  uint ticket;
+#endif
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+#ifdef TICKETLOCK
+  // Take a ticket, and wait for it to be served. Unlike
+  // test-and-set, waiting only reads the lock, so waiters
+  // don't take its cache line from each other and from the
+  // holder on every spin.
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  spins = 0;
+  while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != ticket)
+    spins++;
+#else
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  spins = 0;
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    spins++;
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -38,6 +88,12 @@ acquire(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+  // Count spins locally and update the statistics only once
+  // the lock is held, so that keeping them costs no atomic
+  // operations on the lock's cache line.
+  lk->n++;
+  lk->nts += spins;
+
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
 }
@@ -59,6 +115,12 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef TICKETLOCK
+  // Serve the next ticket. Only the holder writes
+  // lk->owner, so a plain increment would do, but for
+  // the reason below the store is made atomic.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +129,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
@@ -77,7 +140,11 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#ifdef TICKETLOCK
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
+#else
   r = (lk->locked && lk->cpu == mycpu());
+#endif
   return r;
 }
 
@@ -108,3 +175,27 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Sum the acquire() and spin counts of all recorded locks
+// whose names begin with prefix into *n and *nts.
+// Returns the number of locks that matched.
+int
+lockstat(char *prefix, uint64 *n, uint64 *nts)
+{
+  struct spinlock *lk;
+  int len, found;
+
+  len = strlen(prefix);
+  found = 0;
+  *n = *nts = 0;
+  acquire(&lock_locks);
+  for(lk = locks; lk; lk = lk->nextlock){
+    if(strncmp(lk->name, prefix, len) == 0){
+      *n += lk->n;
+      *nts += lk->nts;
+      found++;
+    }
+  }
+  release(&lock_locks);
+  return found;
+}
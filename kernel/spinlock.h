@@ -1,9 +1,20 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock. Built with TICKETLOCK, it is a
+// ticket lock, which CPUs get in the order they asked for
+// it; otherwise it is a test-and-set lock.
 struct spinlock {
+#ifdef TICKETLOCK
+  uint next;         // Ticket for the next CPU to ask.
+  uint owner;        // Ticket of the CPU that holds it, or will next.
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  uint n;            // Number of acquire() calls.
+  uint nts;          // Number of spins waiting in acquire().
+  struct spinlock *nextlock;  // List of all locks, for lockstat().
+  struct spinlock *prevlock;
 };
 
@@ -20,3 +20,18 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_lockstat 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_fcntl  25
+#define SYS_splice 26
+#define SYS_readv  27
+#define SYS_writev 28
+#define SYS_pread  29
+#define SYS_pwrite 30
+#define SYS_poll   31
+#define SYS_pipe2  32
+#define SYS_clone  33
+#define SYS_join   34
+#define SYS_futex_wait 35
+#define SYS_futex_wake 36
@@ -15,18 +15,35 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// If the process has other threads, which could close the file
+// descriptor meanwhile, hold a reference to the file until the
+// system call returns.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc();
+  struct proc *l = p->leader;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&l->fdlock);
+  if((f = l->ofile[fd]) == 0){
+    release(&l->fdlock);
     return -1;
+  }
+  if(l->tslots != 1){
+    if(p->nfdheld == NELEM(p->fdheld))
+      panic("argfd");
+    p->fdheld[p->nfdheld++] = filedup(f);
+  }
+  release(&l->fdlock);
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -34,23 +51,53 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
+// Drop the references argfd() held for a system call.
+void
+fdrelease(void)
+{
+  struct proc *p = myproc();
+
+  while(p->nfdheld > 0)
+    fileclose(p->fdheld[--p->nfdheld]);
+}
+
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *l = myproc()->leader;
 
+  acquire(&l->fdlock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(l->ofile[fd] == 0){
+      l->ofile[fd] = f;
+      release(&l->fdlock);
       return fd;
     }
   }
+  release(&l->fdlock);
   return -1;
 }
 
+// Remove file descriptor fd, unless another thread has
+// already closed it, and perhaps reused it for another
+// file than f. Returns 0 if it removed fd.
+static int
+fdremove(int fd, struct file *f)
+{
+  struct proc *l = myproc()->leader;
+  int r;
+
+  acquire(&l->fdlock);
+  r = l->ofile[fd] == f ? 0 : -1;
+  if(r == 0)
+    l->ofile[fd] = 0;
+  release(&l->fdlock);
+  return r;
+}
+
 uint64
 sys_dup(void)
 {
@@ -59,9 +106,11 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
-    return -1;
   filedup(f);
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -94,15 +143,134 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Copy the iovec array at user address uiov into iov[],
+// checking that the total length fits in an int.
+static int
+argiov(uint64 uiov, int n, struct iovec *iov)
+{
+  uint64 tot;
+  int i;
+
+  if(n < 0 || n > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, n * sizeof(iov[0])) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < n; i++){
+    if(iov[i].iov_len > 0x7fffffff || (tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct iovec iov[IOV_MAX];
+  struct file *f;
+  uint64 uiov;
+  int n;
+
+  argaddr(1, &uiov);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || argiov(uiov, n, iov) < 0)
+    return -1;
+  return filereadv(f, iov, n);
+}
+
+uint64
+sys_writev(void)
+{
+  struct iovec iov[IOV_MAX];
+  struct file *f;
+  uint64 uiov;
+  int n;
+
+  argaddr(1, &uiov);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || argiov(uiov, n, iov) < 0)
+    return -1;
+  return filewritev(f, iov, n);
+}
+
+// pread(fd, buf, n, off) and pwrite(fd, buf, n, off)
+// transfer at offset off without moving the file's
+// offset, so processes sharing a descriptor can each
+// work on their own part of the file.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// poll(fds, n, timeout): wait up to timeout ticks (forever
+// if negative) for one of the n fds to be ready.
+uint64
+sys_poll(void)
+{
+  struct pollfd fds[NOFILE];
+  struct proc *p = myproc();
+  uint64 ufds;
+  int n, timeout, r;
+
+  argaddr(0, &ufds);
+  argint(1, &n);
+  argint(2, &timeout);
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, ufds, n * sizeof(fds[0])) < 0)
+    return -1;
+  if((r = poll(fds, n, timeout)) < 0)
+    return -1;
+  if(copyout(p->pagetable, ufds, (char*)fds, n * sizeof(fds[0])) < 0)
+    return -1;
+  return r;
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 uint64
 sys_close(void)
 {
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argfd(0, &fd, &f) < 0 || fdremove(fd, f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -222,6 +390,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcput(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -341,9 +510,14 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  // a running program's pages are still read from it.
+  if(ip->nexec > 0 && (omode & (O_WRONLY | O_RDWR | O_TRUNC))){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -359,6 +533,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -367,6 +542,11 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  // only now that f is set up can other threads see it.
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -474,32 +654,142 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+// Make a pipe and copy its fds out to fdarray, a user
+// pointer to an array of two integers. flags may ask
+// for O_NONBLOCK on both ends.
+static int
+mkpipe(uint64 fdarray, int flags)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  argaddr(0, &fdarray);
+  if(flags & ~O_NONBLOCK)
+    return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
+  rf->nonblock = wf->nonblock = (flags & O_NONBLOCK) != 0;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+    if(fd0 < 0 || fdremove(fd0, rf) == 0)
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    // another thread may have closed them already.
+    if(fdremove(fd0, rf) == 0)
+      fileclose(rf);
+    if(fdremove(fd1, wf) == 0)
+      fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray;
+
+  argaddr(0, &fdarray);
+  return mkpipe(fdarray, 0);
+}
+
+uint64
+sys_pipe2(void)
+{
+  uint64 fdarray;
+  int flags;
+
+  argaddr(0, &fdarray);
+  argint(1, &flags);
+  return mkpipe(fdarray, flags);
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  argint(1, &cmd);
+  argint(2, &arg);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+
+  switch(cmd){
+  case F_GETFL:
+    return (f->writable ? (f->readable ? O_RDWR : O_WRONLY) : O_RDONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    // only O_NONBLOCK can be changed.
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return piperesize(f->pipe, arg);
+  }
+  return -1;
+}
+
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, off, perm, busy;
+  uint size, filesz;
+  struct file *f;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  if(len == 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  // writes to a private mapping never reach the file.
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+
+  // pages are always readable.
+  perm = PTE_R | PTE_U;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  ilock(f->ip);
+  size = f->ip->size;
+  busy = (prot & PROT_WRITE) && flags == MAP_SHARED && f->ip->nexec > 0;
+  iunlock(f->ip);
+  // a running program's pages are still read from it.
+  if(busy)
+    return -1;
+  filesz = size > off ? size - off : 0;
+  if(filesz > len)
+    filesz = len;
+
+  return vmamap(len, perm, flags, f->ip, off, filesz);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return vmaunmap(addr, len);
+}
@@ -36,16 +36,53 @@ sys_wait(void)
 }
 
 uint64
-sys_sbrk(void)
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  uint64 p;
+  argaddr(0, &p);
+  return join(p);
+}
+
+uint64
+sys_futex_wait(void)
 {
   uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
+
+uint64
+sys_sbrk(void)
+{
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -89,3 +126,22 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// report the number of acquire() calls and of spins
+// waiting for a lock, summed over the kernel locks
+// whose names begin with a prefix.
+uint64
+sys_lockstat(void)
+{
+  char prefix[16];
+  uint64 addr, st[2];
+  int found;
+
+  argaddr(1, &addr);
+  if(argstr(0, prefix, sizeof(prefix)) < 0)
+    return -1;
+  found = lockstat(prefix, &st[0], &st[1]);
+  if(copyout(myproc()->pagetable, addr, (char *)st, sizeof(st)) < 0)
+    return -1;
+  return found;
+}
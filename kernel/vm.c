@@ -3,8 +3,11 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "fcntl.h"
 
 /*
  * the kernel's page table.
@@ -191,6 +194,21 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   }
 }
 
+// Like uvmunmap(), but for the heap and mmap() regions,
+// whose pages are faulted in lazily: pages that were
+// never mapped are skipped.
+void
+uvmunmaplazy(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_V))
+      uvmunmap(pagetable, a, 1, do_free);
+  }
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t
@@ -260,7 +278,7 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    uvmunmaplazy(pagetable, PGROUNDUP(newsz), npages, 1);
   }
 
   return newsz;
@@ -292,46 +310,454 @@ void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
   if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+    uvmunmaplazy(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Map the pages of old in [start, end) into new, sharing
+// the physical memory. Unless shared is set, writable pages
+// become read-only and copy-on-write in both page tables.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
-int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+static int
+uvmshare(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int shared)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = start; i < end; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+    kdup((void*)pa);
+  }
+  // drop this CPU's TLB entries that still allow writes
+  // to pages just made read-only.
+  sfence_vma();
+  return 0;
+
+ err:
+  sfence_vma();
+  uvmunmaplazy(new, start, (i - start) / PGSIZE, 1);
+  return -1;
+}
+
+// Given a parent process's page table, make the
+// child's page table share the parent's physical memory.
+// Writable pages become read-only and copy-on-write in
+// both page tables; uvmcow() gives a process its own
+// copy of such a page when it first writes to it.
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 0);
+}
+
+// Give the process its own writable copy of the
+// copy-on-write user page containing va.
+// Returns 0 on success, -1 if va is not in a
+// copy-on-write page or if out of memory.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  // the last sharer can take the page over without copying.
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Find a file-backed region of p that overlaps [start, end).
+struct vma *
+vmalookup(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip && start < PGROUNDUP(v->end) && end > v->start)
+      return v;
+  }
+  return 0;
+}
+
+// Read the page at va of region v in from its file and
+// map it. A page of a shared mapping is left read-only
+// unless this is a write fault, so that vmfault() can note
+// when it becomes dirty. Caller must not hold any spinlocks.
+static int
+vmafill(pagetable_t pagetable, struct vma *v, uint64 va, int write)
+{
+  struct proc *l = myproc()->leader;
+  uint64 off;
+  uint n;
+  int r, perm;
+  char *mem;
+  pte_t *pte;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  off = va - v->start;
+  if(off < v->filesz){
+    n = v->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    ilock(v->ip);
+    r = readi(v->ip, 0, (uint64)mem, v->off + off, n);
+    iunlock(v->ip);
+    if(r != n){
       kfree(mem);
+      return -1;
+    }
+  }
+
+  perm = v->perm;
+  if(v->flags & MAP_SHARED){
+    if(write)
+      perm |= PTE_D;
+    else
+      perm &= ~PTE_W;
+  }
+
+  // mapped by someone else while we slept in readi()?
+  acquire(&l->vmlock);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V))
+    r = 1;
+  else
+    r = mappages(pagetable, va, PGSIZE, (uint64)mem, perm);
+  release(&l->vmlock);
+  if(r != 0)
+    kfree(mem);
+  return r < 0 ? -1 : 0;
+}
+
+// Handle a page fault at va in the current process's
+// page table. A write to a copy-on-write page gets a
+// private copy; a missing page in a file-backed region is
+// read in from the file; and any other missing page below
+// the process's size is a heap page that sbrk() reserved
+// lazily, and is mapped to a fresh zeroed page.
+// The page table may be shared with other threads, so
+// changes to it are made holding the main thread's vmlock.
+// Returns 0 if the access can be retried, -1 if not.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct proc *l;
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int locked, r;
+
+  if(va >= MAXVA || p == 0 || p->pagetable != pagetable)
+    return -1;
+  l = p->leader;
+  va = PGROUNDDOWN(va);
+  v = vmalookup(l, va, va + 1);
+
+  acquire(&l->vmlock);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    r = -1;
+    if(write && (*pte & PTE_COW)){
+      r = uvmcow(pagetable, va);
+    } else if(write && v && (v->flags & MAP_SHARED) && (v->perm & PTE_W) &&
+              (*pte & PTE_U)){
+      // first write to a page of a writable shared mapping;
+      // it will have to be written back to the file.
+      *pte |= PTE_W | PTE_D;
+      r = 0;
+    } else if((*pte & PTE_U) && (*pte & (write ? PTE_W : PTE_R))){
+      // another thread mapped the page since this one
+      // faulted on it, perhaps through a stale TLB entry.
+      sfence_vma();
+      r = 0;
+    }
+    release(&l->vmlock);
+    return r;
+  }
+  release(&l->vmlock);
+
+  if(v){
+    if(write && (v->perm & PTE_W) == 0)
+      return -1;
+    // reading the file may sleep, which is not allowed
+    // while holding a spinlock. callers that copy to or
+    // from user memory with a lock held use vmprefault()
+    // first, so this should not happen.
+    push_off();
+    locked = mycpu()->noff > 1;
+    pop_off();
+    if(locked)
+      return -1;
+    return vmafill(pagetable, v, va, write);
+  }
+
+  if(va >= l->sz)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  acquire(&l->vmlock);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V))
+    r = 1;  // another thread got there first
+  else
+    r = mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U);
+  release(&l->vmlock);
+  if(r != 0)
+    kfree(mem);
+  return r < 0 ? -1 : 0;
+}
+
+// Read in the not-yet-present file-backed pages of the
+// current process in [va, va+n). Used before copying to
+// or from user memory while holding a lock, since faulting
+// those pages in must sleep on the file. Bad addresses are
+// ignored; the copy itself will fail on them.
+void
+vmprefault(uint64 va, uint64 n)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, last;
+  pte_t *pte;
+
+  if(va + n < va)
+    return;
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++){
+    if(v->ip == 0 || va + n <= v->start || va >= PGROUNDUP(v->end))
+      continue;
+    a = va > v->start ? PGROUNDDOWN(va) : v->start;
+    last = va + n < v->end ? va + n : v->end;
+    for(; a < last; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        vmfault(p->pagetable, a, 0);
+    }
+  }
+}
+
+// Map len bytes of inode ip, starting at file offset off,
+// into the current process, below USERTOP and any earlier
+// mappings. filesz is how many of those bytes the file
+// holds; the rest read as zero. Returns the address of the
+// mapping, or -1 if there is no room, or if the process
+// has other threads, which use its vma[] unlocked.
+uint64
+vmamap(uint64 len, int perm, int flags, struct inode *ip, uint off, uint filesz)
+{
+  struct proc *p = myproc();
+  struct vma *v, *u;
+  uint64 va;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len > USERTOP || p->leader->tslots != 1)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip == 0)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  // take the highest gap that is big enough.
+  va = USERTOP - len;
+  while((u = vmalookup(p, va, va + len)) != 0){
+    if(u->start < len)
+      return -1;
+    va = u->start - len;
+  }
+  if(va < PGROUNDUP(p->sz))
+    return -1;
+
+  v->start = va;
+  v->end = va + len;
+  v->perm = perm;
+  v->flags = flags;
+  v->off = off;
+  v->filesz = filesz;
+  v->ip = idup(ip);
+  return va;
+}
+
+// Write the dirty pages of region v in [start, end) back
+// to its file, if it is a shared mapping. Bytes past the
+// part of the file the region covers are not written, so
+// the file never grows. Errors are ignored, since there is
+// nobody to report them to at exit.
+static void
+vmawriteback(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a, off, pa;
+  uint i, n, n1;
+  pte_t *pte;
+  int r;
+
+  if((v->flags & MAP_SHARED) == 0)
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    off = a - v->start;
+    if(off >= v->filesz)
+      break;
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    n = v->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    for(i = 0; i < n; i += n1){
+      // as in filewrite(), write a few blocks per transaction.
+      n1 = writemax(v->off + off + i);
+      if(n1 > n - i)
+        n1 = n - i;
+      begin_op();
+      ilock(v->ip);
+      r = writei(v->ip, 0, pa + i, v->off + off + i, n1);
+      iunlock(v->ip);
+      end_op();
+      if(r != n1)
+        break;
+    }
+  }
+}
+
+// Remove the mappings of the current process in
+// [va, va+len), which must be all of one region or a piece
+// at its start or end. Dirty pages of a shared mapping
+// are written back to the file first. As with vmamap(),
+// the process must have no other threads.
+// Returns 0 on success, -1 on error.
+int
+vmaunmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end, n;
+
+  if(va % PGSIZE != 0 || len == 0 || va + len < va || p->leader->tslots != 1)
+    return -1;
+  end = PGROUNDUP(va + len);
+  if((v = vmalookup(p, va, va + 1)) == 0 || end > PGROUNDUP(v->end))
+    return -1;
+  if(va != v->start && end != PGROUNDUP(v->end))
+    return -1;
+
+  vmawriteback(p->pagetable, v, va, end);
+  uvmunmaplazy(p->pagetable, va, (end - va) / PGSIZE, 1);
+
+  if(va == v->start && end == PGROUNDUP(v->end)){
+    if(v->flags & VMA_EXEC)
+      iexec(v->ip, -1);
+    begin_op();
+    iput(v->ip);
+    end_op();
+    v->ip = 0;
+  } else if(va == v->start){
+    n = end - v->start;
+    v->filesz = v->filesz > n ? v->filesz - n : 0;
+    v->off += n;
+    v->start = end;
+  } else {
+    if(v->filesz > va - v->start)
+      v->filesz = va - v->start;
+    v->end = va;
+  }
+  return 0;
+}
+
+// Copy p's file-backed regions to the new process np.
+// The pages of exec's segments lie below p->sz and were
+// copied by uvmcopy(); the pages of mmap()ed regions lie
+// above it, and are shared with np if the mapping is
+// MAP_SHARED, or made copy-on-write if not.
+// Returns 0 on success, -1 on failure, having freed
+// any pages it mapped in np.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *u;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip == 0 || v->start < p->sz)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->start, PGROUNDUP(v->end),
+                v->flags & MAP_SHARED) < 0)
       goto err;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip){
+      np->vma[v - p->vma] = *v;
+      idup(v->ip);
+      if(v->flags & VMA_EXEC)
+        iexec(v->ip, 1);
     }
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  for(u = p->vma; u < v; u++){
+    if(u->ip && u->start >= p->sz)
+      uvmunmaplazy(np->pagetable, u->start, (PGROUNDUP(u->end) - u->start) / PGSIZE, 1);
+  }
   return -1;
 }
 
+// Unmap and release all the file-backed regions in
+// vma[NVMA], writing back shared mappings.
+// Must not be called inside a file system transaction.
+void
+vmaclear(pagetable_t pagetable, struct vma *vma)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->ip){
+      vmawriteback(pagetable, v, v->start, PGROUNDUP(v->end));
+      uvmunmaplazy(pagetable, v->start, (PGROUNDUP(v->end) - v->start) / PGSIZE, 1);
+      if(v->flags & VMA_EXEC)
+        iexec(v->ip, -1);
+      begin_op();
+      iput(v->ip);
+      end_op();
+      v->ip = 0;
+    }
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -347,17 +773,28 @@ uvmclear(pagetable_t pagetable, uint64 va)
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Faults in the destination pages if needed, including
+// breaking copy-on-write sharing.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0){
+      if(vmfault(pagetable, va0, 1) < 0)
+        return -1;
+      pte = walk(pagetable, va0, 0);
+    }
+    if((*pte & PTE_U) == 0)
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -372,6 +809,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
+// Faults in lazily-allocated source pages.
 // Return 0 on success, -1 on error.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
@@ -381,8 +819,11 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -408,8 +849,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -0,0 +1,97 @@
+// Measure buffer cache lock contention while several
+// processes read files in parallel.
+//
+// usage: bcachebench [nproc]
+//
+// Each process rereads its own small file; the files
+// together fit in the buffer cache, so almost every
+// bread() is a hit and the cost is dominated by the
+// cache's locking. Prints elapsed ticks and the acquire
+// and spin counts of the bcache locks.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NBLK   4     // blocks per file
+#define ROUNDS 400   // times each process reads its file
+
+char buf[BSIZE];
+
+void
+mkname(char *name, int i)
+{
+  strcpy(name, "bcbench0");
+  name[7] = '0' + i;
+}
+
+void
+reader(int i)
+{
+  char name[16];
+  int r, fd, n;
+
+  mkname(name, i);
+  for(r = 0; r < ROUNDS; r++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      fprintf(2, "bcachebench: open %s failed\n", name);
+      exit(1);
+    }
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      ;
+    close(fd);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[16];
+  uint64 st0[2], st1[2];
+  int nproc, i, j, fd, start, t;
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > 10){
+    fprintf(2, "usage: bcachebench [nproc <= 10]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < nproc; i++){
+    mkname(name, i);
+    fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+    if(fd < 0){
+      fprintf(2, "bcachebench: create %s failed\n", name);
+      exit(1);
+    }
+    memset(buf, 'a' + i, sizeof(buf));
+    for(j = 0; j < NBLK; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  lockstat("bcache", st0);
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0)
+      reader(i);
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  t = uptime() - start;
+  lockstat("bcache", st1);
+
+  printf("bcachebench: %d procs: %d ticks, bcache locks: %l acquires, %l spins\n",
+         nproc, t, st1[0] - st0[0], st1[1] - st0[1]);
+
+  for(i = 0; i < nproc; i++){
+    mkname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
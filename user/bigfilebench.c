@@ -0,0 +1,83 @@
+// Time writing and reading back a large file.
+//
+// usage: bigfilebench [megabytes]
+//
+// The default fs.img has room for a few megabytes; for
+// larger files, build it with e.g. make FSSIZE=200000.
+//
+// All but the first NDIRECT+NINDIRECT blocks of the file are
+// reached through the double-indirect tree, so the bcache lock
+// acquires per MB show how many indirect-block reads bmap()
+// makes on top of the one read or write per data block.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+char buf[BSIZE];
+
+void
+report(char *what, int mb, int t, uint64 *a0, uint64 *a1)
+{
+  if(t == 0)
+    t = 1;
+  printf("bigfilebench: %s %d MB in %d ticks, %l bcache acquires per MB\n",
+         what, mb, t, (a1[0] - a0[0]) / mb);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 a0[2], a1[2];
+  int mb, nblocks, i, fd, start;
+
+  mb = 4;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    fprintf(2, "usage: bigfilebench [megabytes]\n");
+    exit(1);
+  }
+  nblocks = mb * (1024 * 1024 / BSIZE);
+
+  unlink("bigfb");
+  fd = open("bigfb", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    fprintf(2, "bigfilebench: create failed\n");
+    exit(1);
+  }
+  lockstat("bcache", a0);
+  start = uptime();
+  for(i = 0; i < nblocks; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      fprintf(2, "bigfilebench: write of block %d failed\n", i);
+      exit(1);
+    }
+  }
+  close(fd);
+  lockstat("bcache", a1);
+  report("wrote", mb, uptime() - start, a0, a1);
+
+  fd = open("bigfb", O_RDONLY);
+  if(fd < 0){
+    fprintf(2, "bigfilebench: open failed\n");
+    exit(1);
+  }
+  lockstat("bcache", a0);
+  start = uptime();
+  for(i = 0; i < nblocks; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || ((int*)buf)[0] != i){
+      fprintf(2, "bigfilebench: read of block %d failed\n", i);
+      exit(1);
+    }
+  }
+  close(fd);
+  lockstat("bcache", a1);
+  report("read", mb, uptime() - start, a0, a1);
+
+  unlink("bigfb");
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// Measure file creation throughput.
+//
+// usage: createbench [nproc]
+//
+// nproc processes each create, write a block to, and close
+// NFILE files in their own directory, then unlink them all.
+// Every create and unlink is a log transaction, so this
+// mostly measures how fast the log commits.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NFILE 20
+
+char buf[BSIZE];
+
+void
+worker(int id)
+{
+  char dir[8], name[16];
+  int i, fd;
+
+  strcpy(dir, "cbdir0");
+  dir[5] = '0' + id;
+  if(mkdir(dir) < 0 || chdir(dir) < 0){
+    fprintf(2, "createbench: mkdir %s failed\n", dir);
+    exit(1);
+  }
+  strcpy(name, "f00");
+  for(i = 0; i < NFILE; i++){
+    name[1] = '0' + i / 10;
+    name[2] = '0' + i % 10;
+    fd = open(name, O_CREATE | O_WRONLY);
+    if(fd < 0){
+      fprintf(2, "createbench: create %s/%s failed\n", dir, name);
+      exit(1);
+    }
+    write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+  for(i = 0; i < NFILE; i++){
+    name[1] = '0' + i / 10;
+    name[2] = '0' + i % 10;
+    unlink(name);
+  }
+  chdir("..");
+  unlink(dir);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, i, start, t;
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > 6){
+    fprintf(2, "usage: createbench [nproc <= 6]\n");
+    exit(1);
+  }
+
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "createbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(i);
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  t = uptime() - start;
+
+  printf("createbench: %d procs created and removed %d files in %d ticks\n",
+         nproc, nproc * NFILE, t);
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// Time creating many files in one directory.
+//
+// usage: dirbench [nfiles]
+//
+// Creates nfiles empty files in a fresh directory, printing
+// the ticks taken by each STEP of them, then removes them.
+// With a linear directory each create scans all the entries
+// before it, so the steps would get slower and slower.
+//
+// mkfs makes one inode per 10 blocks, so the default fs.img
+// has room for about a thousand files; for 10,000, build it
+// with e.g. make FSSIZE=200000.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define STEP 100
+
+// Set name to "f" followed by the decimal digits of i.
+void
+fname(char *name, int i)
+{
+  char digits[12];
+  int n;
+
+  n = 0;
+  do {
+    digits[n++] = '0' + i % 10;
+    i /= 10;
+  } while(i > 0);
+  *name++ = 'f';
+  while(n > 0)
+    *name++ = digits[--n];
+  *name = '\0';
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[16];
+  int nfiles, i, fd, start, t0;
+
+  nfiles = 800;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1){
+    fprintf(2, "usage: dirbench [nfiles]\n");
+    exit(1);
+  }
+
+  if(mkdir("dbdir") < 0 || chdir("dbdir") < 0){
+    fprintf(2, "dirbench: mkdir dbdir failed\n");
+    exit(1);
+  }
+
+  t0 = start = uptime();
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    fd = open(name, O_CREATE | O_WRONLY);
+    if(fd < 0){
+      fprintf(2, "dirbench: create %s failed\n", name);
+      break;
+    }
+    close(fd);
+    if((i + 1) % STEP == 0){
+      printf("dirbench: files %d-%d: %d ticks\n", i + 1 - STEP, i, uptime() - start);
+      start = uptime();
+    }
+  }
+  printf("dirbench: created %d files in %d ticks\n", i, uptime() - t0);
+
+  start = uptime();
+  while(--i >= 0){
+    fname(name, i);
+    unlink(name);
+  }
+  printf("dirbench: removed them in %d ticks\n", uptime() - start);
+
+  chdir("..");
+  unlink("dbdir");
+  exit(0);
+}
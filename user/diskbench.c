@@ -0,0 +1,104 @@
+// Measure disk read throughput with several readers.
+//
+// usage: diskbench [nproc]
+//
+// Writes nproc files of NBLK blocks each, far more than the
+// buffer cache holds, then has nproc processes read their
+// own file at the same time and reports the blocks read
+// per tick. Each reader keeps a request outstanding, so
+// this shows how well the disk driver overlaps requests.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NBLK   200   // blocks per file
+#define ROUNDS 4     // times each process reads its file
+
+char buf[BSIZE];
+
+void
+mkname(char *name, int i)
+{
+  strcpy(name, "dbench0");
+  name[6] = '0' + i;
+}
+
+void
+reader(int i)
+{
+  char name[16];
+  int r, fd;
+
+  mkname(name, i);
+  for(r = 0; r < ROUNDS; r++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      fprintf(2, "diskbench: open %s failed\n", name);
+      exit(1);
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[16];
+  int nproc, i, j, fd, start, t;
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > 10){
+    fprintf(2, "usage: diskbench [nproc <= 10]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < nproc; i++){
+    mkname(name, i);
+    fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+    if(fd < 0){
+      fprintf(2, "diskbench: create %s failed\n", name);
+      exit(1);
+    }
+    memset(buf, 'a' + i, sizeof(buf));
+    for(j = 0; j < NBLK; j++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        fprintf(2, "diskbench: write %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "diskbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      reader(i);
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  t = uptime() - start;
+
+  if(t == 0)
+    t = 1;
+  printf("diskbench: %d procs read %d blocks in %d ticks (%d blocks/tick)\n",
+         nproc, nproc * NBLK * ROUNDS, t, nproc * NBLK * ROUNDS / t);
+
+  for(i = 0; i < nproc; i++){
+    mkname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
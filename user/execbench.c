@@ -0,0 +1,45 @@
+// Measure how long it takes to start a large program.
+//
+// usage: execbench [prog [arg ...]]
+//
+// Runs prog (by default "usertests -?", which prints a usage
+// message and exits at once) NEXEC times with its output
+// discarded, and reports the elapsed ticks. Since exec reads
+// program pages in only as they are touched, this should
+// depend little on the size of prog.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NEXEC 50
+
+char *defargv[] = { "usertests", "-?", 0 };
+
+int
+main(int argc, char *argv[])
+{
+  char **av;
+  int i, pid, start, t;
+
+  av = argc > 1 ? argv + 1 : defargv;
+
+  start = uptime();
+  for(i = 0; i < NEXEC; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);
+      exec(av[0], av);
+      fprintf(2, "execbench: exec %s failed\n", av[0]);
+      exit(1);
+    }
+    wait(0);
+  }
+  t = uptime() - start;
+  printf("execbench: %d execs of %s in %d ticks\n", NEXEC, av[0], t);
+  exit(0);
+}
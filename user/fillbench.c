@@ -0,0 +1,55 @@
+// Time block allocation as the disk fills up.
+//
+// usage: fillbench
+//
+// Writes FILEMB-megabyte files until the disk is full,
+// printing the ticks each file took, then removes them.
+// If balloc() had to search past all the allocated blocks
+// every time, the later files would take far longer.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define FILEMB 16
+#define MAXFILES 32
+
+char buf[BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  char name[8];
+  int nfiles, i, fd, start, full;
+
+  strcpy(name, "fill00");
+  full = 0;
+  for(nfiles = 0; nfiles < MAXFILES && !full; nfiles++){
+    name[4] = '0' + nfiles / 10;
+    name[5] = '0' + nfiles % 10;
+    fd = open(name, O_CREATE | O_WRONLY);
+    if(fd < 0){
+      fprintf(2, "fillbench: create %s failed\n", name);
+      break;
+    }
+    start = uptime();
+    for(i = 0; i < FILEMB * (1024 * 1024 / BSIZE); i++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        full = 1;
+        break;
+      }
+    }
+    close(fd);
+    printf("fillbench: file %d: %d KB in %d ticks\n",
+           nfiles, i * (BSIZE / 1024), uptime() - start);
+  }
+
+  for(i = 0; i < nfiles; i++){
+    name[4] = '0' + i / 10;
+    name[5] = '0' + i % 10;
+    unlink(name);
+  }
+  exit(0);
+}
@@ -0,0 +1,53 @@
+// Measure fork() latency as process memory grows.
+//
+// usage: forkbench
+//
+// For each heap size, touch every heap page, then time
+// NFORK fork()s whose children exit at once. With
+// copy-on-write fork the cost should grow with the size
+// of the page table, not with the memory in use.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NFORK 100
+
+int mbytes[] = { 0, 1, 4, 16 };
+
+int
+main(int argc, char *argv[])
+{
+  char *heap, *end;
+  int i, j, pid, start, t;
+  uint64 sz, cur;
+
+  heap = sbrk(0);
+  cur = 0;
+  for(i = 0; i < sizeof(mbytes)/sizeof(mbytes[0]); i++){
+    sz = (uint64)mbytes[i] * 1024 * 1024;
+    if(sbrk(sz - cur) == (char*)-1){
+      fprintf(2, "forkbench: sbrk failed\n");
+      exit(1);
+    }
+    cur = sz;
+    end = heap + sz;
+    for(char *a = heap; a < end; a += 4096)
+      *a = 1;
+
+    start = uptime();
+    for(j = 0; j < NFORK; j++){
+      pid = fork();
+      if(pid < 0){
+        fprintf(2, "forkbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+    t = uptime() - start;
+    printf("forkbench: %d MB heap: %d forks in %d ticks\n", mbytes[i], NFORK, t);
+  }
+  exit(0);
+}
@@ -0,0 +1,89 @@
+// Compare a spinlock with a futex-based mutex under
+// contention.
+//
+// usage: futexbench [maxthreads [iterations]]
+//
+// 1, 2, 4, ... up to maxthreads threads each take the lock,
+// bump a shared counter and let it go iterations times.
+// A spinning waiter burns its CPU, and once there are more
+// threads than CPUs it may spin away a whole time slice
+// while the holder is descheduled; a mutex waiter sleeps
+// in futex_wait() instead.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXTHREADS 15
+
+volatile int spinlock;
+struct mutex mutex;
+volatile int counter;
+int iters;
+int usefutex;
+
+void
+worker(void *a)
+{
+  for(int i = 0; i < iters; i++){
+    if(usefutex)
+      mutex_lock(&mutex);
+    else
+      while(__sync_lock_test_and_set(&spinlock, 1) != 0)
+        ;
+    counter++;
+    if(usefutex)
+      mutex_unlock(&mutex);
+    else
+      __sync_lock_release(&spinlock);
+  }
+}
+
+// Run nthreads workers. Returns ticks.
+int
+run(int nthreads)
+{
+  int i, start;
+
+  counter = 0;
+  start = uptime();
+  for(i = 0; i < nthreads; i++){
+    if(kthread_create(worker, 0) < 0){
+      fprintf(2, "futexbench: kthread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nthreads; i++)
+    kthread_join();
+  if(counter != nthreads * iters){
+    fprintf(2, "futexbench: counted %d, expected %d\n", counter, nthreads * iters);
+    exit(1);
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxthreads, n;
+
+  maxthreads = 8;
+  iters = 100000;
+  if(argc > 1)
+    maxthreads = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+  if(maxthreads < 1 || maxthreads > MAXTHREADS || iters < 1){
+    fprintf(2, "usage: futexbench [maxthreads [iterations]]\n");
+    exit(1);
+  }
+
+  mutex_init(&mutex);
+  for(n = 1; n <= maxthreads; n *= 2){
+    usefutex = 0;
+    printf("futexbench: %d threads with spinlock: %d ticks\n", n, run(n));
+    usefutex = 1;
+    printf("futexbench: %d threads with mutex: %d ticks\n", n, run(n));
+  }
+  exit(0);
+}
@@ -0,0 +1,65 @@
+// Measure page allocator throughput as the number of
+// processes allocating at the same time grows.
+//
+// usage: kallocbench [maxprocs]
+//
+// Each process repeatedly grows its heap, touches every
+// new page, and shrinks the heap again, so nearly all of
+// its time goes to kalloc() and kfree(). With per-CPU free
+// lists the elapsed ticks should stay roughly flat while
+// the number of processes is no larger than CPUS.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NPAGE  64    // pages per heap growth
+#define ROUNDS 200   // growths per process
+
+void
+worker(void)
+{
+  char *a;
+  int i, j;
+
+  for(i = 0; i < ROUNDS; i++){
+    a = sbrk(NPAGE*4096);
+    if(a == (char*)-1){
+      fprintf(2, "kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(j = 0; j < NPAGE; j++)
+      a[j*4096] = j;
+    sbrk(-NPAGE*4096);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxprocs, n, i, pid, start, t;
+
+  maxprocs = 4;
+  if(argc > 1)
+    maxprocs = atoi(argv[1]);
+
+  for(n = 1; n <= maxprocs; n++){
+    start = uptime();
+    for(i = 0; i < n; i++){
+      pid = fork();
+      if(pid < 0){
+        fprintf(2, "kallocbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        worker();
+    }
+    for(i = 0; i < n; i++)
+      wait(0);
+    t = uptime() - start;
+    printf("kallocbench: %d procs, %d pages each: %d ticks\n",
+           n, ROUNDS*NPAGE, t);
+  }
+  exit(0);
+}
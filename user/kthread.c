@@ -0,0 +1,60 @@
+// Threads made with clone(), which the kernel schedules,
+// so that they run in parallel on different CPUs. They
+// share all memory, but malloc() is not thread-safe, so
+// create and join them from one thread at a time.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define STACKSIZE 4096
+
+// Kept at the top of a thread's stack.
+struct kthread {
+  void (*fn)(void*);
+  void *arg;
+  void *stack;    // from malloc()
+  uint64 pad;     // keeps sp 16-byte aligned
+};
+
+// The first function of every thread. clone() leaves
+// nothing to return to, so exit here.
+static void
+kthread_start(void *a)
+{
+  struct kthread *t = a;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+// Start fn(arg) in a new thread. Returns its pid, or -1.
+int
+kthread_create(void (*fn)(void*), void *arg)
+{
+  struct kthread *t;
+  char *stack;
+  int pid;
+
+  if((stack = malloc(STACKSIZE)) == 0)
+    return -1;
+  t = (struct kthread*)(((uint64)stack + STACKSIZE) & ~15) - 1;
+  t->fn = fn;
+  t->arg = arg;
+  t->stack = stack;
+  if((pid = clone(kthread_start, t, t)) < 0)
+    free(stack);
+  return pid;
+}
+
+// Wait for one of this thread's threads to exit, and free
+// its stack. Returns its pid, or -1 if there are none.
+int
+kthread_join(void)
+{
+  struct kthread *t;
+  int pid;
+
+  if((pid = join((void**)&t)) >= 0)
+    free(t->stack);
+  return pid;
+}
@@ -0,0 +1,87 @@
+// Measure the throughput and fairness of a contended
+// kernel spinlock.
+//
+// usage: lockbench [nprocs [ticks]]
+//
+// nprocs processes call uptime(), which does little but
+// take and release tickslock, as fast as they can for the
+// given number of ticks. Prints the total calls, the
+// fewest and most made by one process, and the spins per
+// acquire from lockstat(). Run it with CPUS=8, built with
+// and without TICKETLOCK=1: a test-and-set lock tends to go
+// to whichever CPU last had it, so the spread between the
+// fewest and the most is wide, while a ticket lock serves
+// every waiter in turn.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  uint64 a0[2], a1[2];
+  int fds[2], nprocs, ticks, i, n, end, lo, hi;
+  uint64 total;
+
+  nprocs = 8;
+  ticks = 100;
+  if(argc > 1)
+    nprocs = atoi(argv[1]);
+  if(argc > 2)
+    ticks = atoi(argv[2]);
+  if(nprocs < 1 || ticks < 1){
+    fprintf(2, "usage: lockbench [nprocs [ticks]]\n");
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+
+  lockstat("time", a0);
+  end = uptime() + 1 + ticks;
+  for(i = 0; i < nprocs; i++){
+    n = fork();
+    if(n < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(n == 0){
+      close(fds[0]);
+      // start together on a tick boundary.
+      while(uptime() < end - ticks)
+        ;
+      for(n = 0; uptime() < end; n++)
+        ;
+      write(fds[1], &n, sizeof(n));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+
+  total = 0;
+  lo = -1;
+  hi = 0;
+  for(i = 0; i < nprocs; i++){
+    if(read(fds[0], &n, sizeof(n)) != sizeof(n)){
+      fprintf(2, "lockbench: lost a count\n");
+      exit(1);
+    }
+    total += n;
+    if(lo < 0 || n < lo)
+      lo = n;
+    if(n > hi)
+      hi = n;
+  }
+  for(i = 0; i < nprocs; i++)
+    wait(0);
+  lockstat("time", a1);
+
+  printf("lockbench: %d procs, %d ticks: %l calls (%l per tick)\n",
+         nprocs, ticks, total, total / ticks);
+  printf("lockbench: per proc fewest %d, most %d\n", lo, hi);
+  printf("lockbench: %l spins per acquire\n",
+         (a1[1] - a0[1]) / (a1[0] - a0[0] ? a1[0] - a0[0] : 1));
+  exit(0);
+}
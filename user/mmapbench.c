@@ -0,0 +1,77 @@
+// Compare reading a file with read() against mapping it
+// with mmap().
+//
+// usage: mmapbench
+//
+// Creates a FILESZ-byte file, then sums its bytes PASSES
+// times, first through a read() buffer and then through a
+// single MAP_PRIVATE mapping, and reports the ticks for each.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FILESZ  (200*1024)
+#define PASSES  20
+
+char buf[4096];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, pass, start, t1, t2;
+  uint sum1, sum2;
+  char *p;
+
+  unlink("mmapbench.tmp");
+  fd = open("mmapbench.tmp", O_CREATE | O_RDWR);
+  if(fd < 0){
+    fprintf(2, "mmapbench: create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  for(i = 0; i < FILESZ; i += sizeof(buf)){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "mmapbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  sum1 = 0;
+  start = uptime();
+  for(pass = 0; pass < PASSES; pass++){
+    fd = open("mmapbench.tmp", O_RDONLY);
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      for(i = 0; i < n; i++)
+        sum1 += (uchar)buf[i];
+    close(fd);
+  }
+  t1 = uptime() - start;
+
+  sum2 = 0;
+  start = uptime();
+  fd = open("mmapbench.tmp", O_RDONLY);
+  p = mmap(0, FILESZ, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    fprintf(2, "mmapbench: mmap failed\n");
+    exit(1);
+  }
+  for(pass = 0; pass < PASSES; pass++)
+    for(i = 0; i < FILESZ; i++)
+      sum2 += (uchar)p[i];
+  munmap(p, FILESZ);
+  t2 = uptime() - start;
+
+  if(sum1 != sum2){
+    fprintf(2, "mmapbench: sums differ\n");
+    exit(1);
+  }
+  printf("mmapbench: %d x %d bytes: read %d ticks, mmap %d ticks\n",
+         PASSES, FILESZ, t1, t2);
+  unlink("mmapbench.tmp");
+  exit(0);
+}
@@ -0,0 +1,106 @@
+// Time path name lookups in a directory tree.
+//
+// usage: namebench [fanout [depth]]
+//
+// Builds a tree of directories fanout wide and depth deep,
+// then stats every directory in it ROUNDS times, the way
+// find or ls -R would. Every stat looks up each component
+// of a path, so the bcache acquires per stat show how many
+// inode and directory blocks each lookup reads.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define ROUNDS 10
+
+int fanout, depth;
+
+// Make (mk) or stat the tree below path, whose
+// length is n, down to level. Returns the number
+// of directories visited, or -1 on failure.
+int
+walk(char *path, int n, int level, int mk)
+{
+  struct stat st;
+  int i, m, total;
+
+  if(level == depth)
+    return 0;
+  total = 0;
+  for(i = 0; i < fanout; i++){
+    path[n] = '/';
+    path[n+1] = 'a' + i;
+    path[n+2] = '\0';
+    if(mk ? mkdir(path) : stat(path, &st)){
+      fprintf(2, "namebench: %s %s failed\n", mk ? "mkdir" : "stat", path);
+      return -1;
+    }
+    if((m = walk(path, n + 2, level + 1, mk)) < 0)
+      return -1;
+    total += m + 1;
+  }
+  path[n] = '\0';
+  return total;
+}
+
+// Remove the tree below path.
+void
+rmtree(char *path, int n, int level)
+{
+  int i;
+
+  if(level == depth)
+    return;
+  for(i = 0; i < fanout; i++){
+    path[n] = '/';
+    path[n+1] = 'a' + i;
+    path[n+2] = '\0';
+    rmtree(path, n + 2, level + 1);
+    path[n+2] = '\0';
+    unlink(path);
+  }
+  path[n] = '\0';
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[64];
+  uint64 a0[2], a1[2];
+  int i, n, start, t;
+
+  fanout = 3;
+  depth = 4;
+  if(argc > 1)
+    fanout = atoi(argv[1]);
+  if(argc > 2)
+    depth = atoi(argv[2]);
+  if(fanout < 1 || fanout > 26 || depth < 1 || 6 + 2*depth >= sizeof(path)){
+    fprintf(2, "usage: namebench [fanout [depth]]\n");
+    exit(1);
+  }
+
+  strcpy(path, "nbtree");
+  if(mkdir(path) < 0 || (n = walk(path, strlen(path), 0, 1)) < 0){
+    fprintf(2, "namebench: cannot build tree\n");
+    exit(1);
+  }
+
+  lockstat("bcache", a0);
+  start = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    if(walk(path, strlen(path), 0, 0) < 0)
+      exit(1);
+  }
+  t = uptime() - start;
+  lockstat("bcache", a1);
+
+  printf("namebench: %d stats of %d directories in %d ticks, %l bcache acquires per stat\n",
+         ROUNDS * n, n, t, (a1[0] - a0[0]) / (ROUNDS * n));
+
+  rmtree(path, strlen(path), 0);
+  unlink(path);
+  exit(0);
+}
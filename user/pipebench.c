@@ -0,0 +1,74 @@
+// Measure pipe throughput.
+//
+// usage: pipebench [megabytes [pipesize]]
+//
+// A child writes megabytes MB into a pipe in CHUNK-byte
+// writes and the parent reads them. If pipesize is given,
+// the pipe is first resized with F_SETPIPE_SZ.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define CHUNK 8192
+
+char buf[CHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], mb, size, pid, n, start, t;
+  uint64 total, left;
+
+  mb = 100;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    fprintf(2, "usage: pipebench [megabytes [pipesize]]\n");
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    fprintf(2, "pipebench: pipe failed\n");
+    exit(1);
+  }
+  if(argc > 2 && fcntl(fds[1], F_SETPIPE_SZ, atoi(argv[2])) < 0){
+    fprintf(2, "pipebench: F_SETPIPE_SZ %s failed\n", argv[2]);
+    exit(1);
+  }
+  size = fcntl(fds[0], F_GETPIPE_SZ, 0);
+  total = (uint64)mb * 1024 * 1024;
+
+  start = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(left = total; left > 0; left -= n){
+      n = left < CHUNK ? left : CHUNK;
+      if(write(fds[1], buf, n) != n){
+        fprintf(2, "pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  for(left = total; (n = read(fds[0], buf, sizeof(buf))) > 0; left -= n)
+    ;
+  wait(0);
+  t = uptime() - start;
+  if(left != 0){
+    fprintf(2, "pipebench: read %l bytes, expected %l\n", total - left, total);
+    exit(1);
+  }
+  if(t == 0)
+    t = 1;
+  printf("pipebench: %d MB through a %d-byte pipe in %d ticks (%d KB/tick)\n",
+         mb, size, t, (int)(total / 1024 / t));
+  exit(0);
+}
@@ -0,0 +1,95 @@
+// Measure one process serving many pipes with poll().
+//
+// usage: pollbench [nproducers [messages]]
+//
+// Each of nproducers children writes messages MSGSIZE-byte
+// messages into its own pipe. The parent reads them all,
+// using poll() to find which pipes have data, so a single
+// process serves every producer.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/poll.h"
+#include "user/user.h"
+
+#define MAXPROD 60
+#define MSGSIZE 64
+
+char buf[4096];
+
+int
+main(int argc, char *argv[])
+{
+  struct pollfd pfd[MAXPROD];
+  int fds[2], nprod, nmsg, i, j, n, pid, nopen, npoll, start, t;
+  uint64 total;
+
+  nprod = 32;
+  nmsg = 1000;
+  if(argc > 1)
+    nprod = atoi(argv[1]);
+  if(argc > 2)
+    nmsg = atoi(argv[2]);
+  if(nprod < 1 || nprod > MAXPROD || nmsg < 1){
+    fprintf(2, "usage: pollbench [nproducers [messages]]\n");
+    exit(1);
+  }
+
+  start = uptime();
+  for(i = 0; i < nprod; i++){
+    if(pipe(fds) < 0){
+      fprintf(2, "pollbench: pipe failed\n");
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "pollbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < i; j++)
+        close(pfd[j].fd);
+      close(fds[0]);
+      for(j = 0; j < nmsg; j++)
+        if(write(fds[1], buf, MSGSIZE) != MSGSIZE)
+          exit(1);
+      exit(0);
+    }
+    close(fds[1]);
+    pfd[i].fd = fds[0];
+    pfd[i].events = POLLIN;
+  }
+
+  total = 0;
+  npoll = 0;
+  for(nopen = nprod; nopen > 0; ){
+    if(poll(pfd, nprod, -1) < 1){
+      fprintf(2, "pollbench: poll failed\n");
+      exit(1);
+    }
+    npoll++;
+    for(i = 0; i < nprod; i++){
+      if(pfd[i].revents == 0)
+        continue;
+      if((n = read(pfd[i].fd, buf, sizeof(buf))) > 0){
+        total += n;
+      } else {
+        close(pfd[i].fd);
+        pfd[i].fd = -1;
+        nopen--;
+      }
+    }
+  }
+  for(i = 0; i < nprod; i++)
+    wait(0);
+  t = uptime() - start;
+
+  if(total != (uint64)nprod * nmsg * MSGSIZE){
+    fprintf(2, "pollbench: read %l bytes, expected %l\n",
+            total, (uint64)nprod * nmsg * MSGSIZE);
+    exit(1);
+  }
+  printf("pollbench: %d messages from %d producers in %d ticks, %d polls\n",
+         nprod * nmsg, nprod, t, npoll);
+  exit(0);
+}
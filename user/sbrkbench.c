@@ -0,0 +1,45 @@
+// Measure the cost of reserving heap memory that is
+// mostly never used.
+//
+// usage: sbrkbench
+//
+// Each round grows the heap by HEAPMB megabytes, touches
+// one page per megabyte, and gives the memory back. With
+// lazy allocation only the touched pages cost anything.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define HEAPMB  32
+#define ROUNDS  20
+
+int
+main(int argc, char *argv[])
+{
+  char *heap;
+  int i, j, start, t;
+  uint64 sz = (uint64)HEAPMB * 1024 * 1024;
+
+  start = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    heap = sbrk(sz);
+    if(heap == (char*)-1){
+      fprintf(2, "sbrkbench: sbrk failed\n");
+      exit(1);
+    }
+    for(j = 0; j < HEAPMB; j++)
+      heap[j * 1024 * 1024] = j;
+    for(j = 0; j < HEAPMB; j++){
+      if(heap[j * 1024 * 1024] != (char)j){
+        fprintf(2, "sbrkbench: bad heap contents\n");
+        exit(1);
+      }
+    }
+    sbrk(-sz);
+  }
+  t = uptime() - start;
+  printf("sbrkbench: %d x %d MB sbrk, %d pages touched: %d ticks\n",
+         ROUNDS, HEAPMB, HEAPMB, t);
+  exit(0);
+}
@@ -0,0 +1,76 @@
+// Measure scheduling latency under load.
+//
+// usage: schedlat [nbusy]
+//
+// Starts nbusy (default 4) compute-bound processes, then
+// times ROUNDS round trips of a byte between two processes
+// over a pair of pipes. Each round trip needs two wakeups
+// and two trips through the scheduler, so the result tracks
+// how quickly a woken process gets a CPU.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS 2000
+#define MAXBUSY 32
+
+int
+main(int argc, char *argv[])
+{
+  int nbusy, i, pid, start, t;
+  int busy[MAXBUSY];
+  int ab[2], ba[2];
+  char c;
+
+  nbusy = argc > 1 ? atoi(argv[1]) : 4;
+  if(nbusy > MAXBUSY)
+    nbusy = MAXBUSY;
+
+  for(i = 0; i < nbusy; i++){
+    busy[i] = fork();
+    if(busy[i] < 0){
+      fprintf(2, "schedlat: fork failed\n");
+      exit(1);
+    }
+    if(busy[i] == 0)
+      for(;;)
+        ;
+  }
+
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    fprintf(2, "schedlat: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "schedlat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < ROUNDS; i++){
+      if(read(ab[0], &c, 1) != 1)
+        exit(1);
+      write(ba[1], &c, 1);
+    }
+    exit(0);
+  }
+
+  start = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    write(ab[1], "x", 1);
+    if(read(ba[0], &c, 1) != 1){
+      fprintf(2, "schedlat: read failed\n");
+      break;
+    }
+  }
+  t = uptime() - start;
+  wait(0);
+
+  for(i = 0; i < nbusy; i++){
+    kill(busy[i]);
+    wait(0);
+  }
+  printf("schedlat: %d busy, %d round trips in %d ticks\n", nbusy, ROUNDS, t);
+  exit(0);
+}
@@ -0,0 +1,89 @@
+// Compare feeding a file into a pipe with read()/write()
+// and with splice().
+//
+// usage: splicebench [megabytes]
+//
+// Writes a file of that size, then twice has a child copy
+// it into a pipe that the parent drains, first through a
+// user buffer and then with splice(), which skips the copy
+// out to user space and back.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define CHUNK 8192
+
+char buf[CHUNK];
+
+// Time sending the file through a pipe. Returns ticks.
+int
+run(int usesplice)
+{
+  int fds[2], fd, n, pid, start;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "splicebench: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "splicebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if((fd = open("sbfile", O_RDONLY)) < 0)
+      exit(1);
+    if(usesplice){
+      while((n = splice(fd, fds[1], CHUNK)) > 0)
+        ;
+    } else {
+      while((n = read(fd, buf, CHUNK)) > 0)
+        if(write(fds[1], buf, n) != n)
+          exit(1);
+    }
+    exit(n < 0);
+  }
+  close(fds[1]);
+  while(read(fds[0], buf, CHUNK) > 0)
+    ;
+  close(fds[0]);
+  wait(0);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, fd, i;
+
+  mb = 8;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    fprintf(2, "usage: splicebench [megabytes]\n");
+    exit(1);
+  }
+
+  fd = open("sbfile", O_CREATE | O_TRUNC | O_WRONLY);
+  if(fd < 0){
+    fprintf(2, "splicebench: create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < mb * (1024 * 1024 / CHUNK); i++){
+    if(write(fd, buf, CHUNK) != CHUNK){
+      fprintf(2, "splicebench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  printf("splicebench: %d MB with read/write: %d ticks\n", mb, run(0));
+  printf("splicebench: %d MB with splice: %d ticks\n", mb, run(1));
+
+  unlink("sbfile");
+  exit(0);
+}
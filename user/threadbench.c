@@ -0,0 +1,79 @@
+// Measure how compute-bound work on shared data scales
+// with threads made by clone().
+//
+// usage: threadbench [maxthreads]
+//
+// Fills an array of N ints, then has 1, 2, 4, ... up to
+// maxthreads threads each sum an equal slice of it ROUNDS
+// times, and prints the ticks each count took. On a
+// machine with that many CPUs the time should fall in
+// proportion.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N (256 * 1024)
+#define ROUNDS 40
+#define MAXTHREADS 15
+
+int data[N];
+uint64 sums[MAXTHREADS];
+int nthreads;
+
+void
+worker(void *a)
+{
+  int id = (uint64)a;
+  int lo = N / nthreads * id;
+  int hi = id == nthreads - 1 ? N : lo + N / nthreads;
+  uint64 sum;
+  int i, r;
+
+  sum = 0;
+  for(r = 0; r < ROUNDS; r++)
+    for(i = lo; i < hi; i++)
+      sum += data[i];
+  sums[id] = sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxthreads, i, start, t;
+  uint64 total;
+
+  maxthreads = 8;
+  if(argc > 1)
+    maxthreads = atoi(argv[1]);
+  if(maxthreads < 1 || maxthreads > MAXTHREADS){
+    fprintf(2, "usage: threadbench [maxthreads]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++)
+    data[i] = i;
+
+  for(nthreads = 1; nthreads <= maxthreads; nthreads *= 2){
+    start = uptime();
+    for(i = 0; i < nthreads; i++){
+      if(kthread_create(worker, (void*)(uint64)i) < 0){
+        fprintf(2, "threadbench: kthread_create failed\n");
+        exit(1);
+      }
+    }
+    for(i = 0; i < nthreads; i++)
+      kthread_join();
+    t = uptime() - start;
+
+    total = 0;
+    for(i = 0; i < nthreads; i++)
+      total += sums[i];
+    if(total != (uint64)ROUNDS * N * (N - 1) / 2){
+      fprintf(2, "threadbench: wrong sum with %d threads\n", nthreads);
+      exit(1);
+    }
+    printf("threadbench: %d threads: %d ticks\n", nthreads, t);
+  }
+  exit(0);
+}
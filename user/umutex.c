@@ -0,0 +1,80 @@
+// Mutexes and condition variables for threads made with
+// clone(), or for processes sharing memory through mmap().
+// Taking a free mutex, or releasing one that no one waits
+// for, is a single atomic instruction; only contention
+// costs system calls, to sleep in futex_wait() and to wake
+// sleepers with futex_wake().
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+// m->state is 0 when m is free, 1 when it is held, and 2
+// when it is held and other threads may be waiting for it.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // mark it contended, so that the holder will wake us,
+  // and sleep until it is free.
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+    futex_wake(&m->state, 1);
+}
+
+// c->seq changes on every signal, so that a waiter that
+// read it before releasing the mutex doesn't sleep through
+// a signal that came after.
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait for a signal on c, and take m again.
+// Wakeups can be spurious, so check the condition again.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+// Wake one thread waiting on c.
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&c->seq, 1);
+}
+
+// Wake every thread waiting on c.
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -1,4 +1,6 @@
 struct stat;
+struct iovec;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -22,6 +24,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lockstat(const char*, uint64*);
+void *mmap(void*, uint64, int, int, int, uint);
+int munmap(void*, uint64);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int poll(struct pollfd*, int, int);
+int pipe2(int*, int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex_wait(volatile int*, int);
+int futex_wake(volatile int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +56,22 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// kthread.c
+int kthread_create(void (*)(void*), void*);
+int kthread_join(void);
+
+// umutex.c
+struct mutex {
+  volatile int state;
+};
+struct cond {
+  volatile int seq;
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
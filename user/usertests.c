@@ -4,6 +4,7 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/poll.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -575,6 +576,9 @@ writetest(char *s)
   }
 }
 
+// big enough to need the double-indirect tree.
+#define NBIG (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -586,7 +590,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +610,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -785,6 +789,694 @@ pipe1(char *s)
   }
 }
 
+// resizing a pipe keeps the data in it.
+void
+pipesz(char *s)
+{
+  int fds[2], i;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3000; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, 3000) != 3000){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 65536) != 65536 ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != 65536){
+    printf("%s: F_SETPIPE_SZ 65536 failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 1) != 4096){
+    printf("%s: F_SETPIPE_SZ 1 failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 1 << 30) != -1){
+    printf("%s: F_SETPIPE_SZ 1<<30 succeeded\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, sizeof(buf)) != 3000){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3000; i++){
+    if((buf[i] & 0xff) != (i & 0xff)){
+      printf("%s: wrong data after resize\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+}
+
+// splice a file through a pipe into another file.
+void
+splicetest(char *s)
+{
+  enum { N = 10000 };
+  int fd, fds[2], i, n, pid, xstatus;
+
+  unlink("splice0");
+  unlink("splice1");
+  fd = open("splice0", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create splice0 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    char c = i % 251;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write splice0 failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice0", O_RDONLY);
+    while((n = splice(fd, fds[1], 3000)) > 0)
+      ;
+    exit(n == 0 ? 0 : 1);
+  }
+  close(fds[1]);
+  fd = open("splice1", O_CREATE|O_WRONLY);
+  while((n = splice(fds[0], fd, 5000)) > 0)
+    ;
+  close(fd);
+  close(fds[0]);
+  wait(&xstatus);
+  if(n != 0 || xstatus != 0){
+    printf("%s: splice failed\n", s);
+    exit(1);
+  }
+
+  fd = open("splice1", O_RDONLY);
+  for(i = 0; (n = read(fd, buf, sizeof(buf))) > 0; i += n){
+    for(int j = 0; j < n; j++){
+      if((buf[j] & 0xff) != (i + j) % 251){
+        printf("%s: wrong data at %d\n", s, i + j);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(i != N){
+    printf("%s: spliced %d bytes, not %d\n", s, i, N);
+    exit(1);
+  }
+  if(splice(fds[0], 1, 1) != -1){
+    printf("%s: splice of closed fd succeeded\n", s);
+    exit(1);
+  }
+  unlink("splice0");
+  unlink("splice1");
+}
+
+// writev() and readv() on a file and a pipe.
+void
+iovtest(char *s)
+{
+  struct iovec iov[3];
+  char a[5], b[3000], c[7];
+  int fd, fds[2], i;
+
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i;
+  iov[0].iov_base = "head:";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = ":trail";
+  iov[2].iov_len = 7;
+
+  fd = open("iovf", O_CREATE|O_RDWR|O_TRUNC);
+  if(fd < 0 || writev(fd, iov, 3) != 5 + sizeof(b) + 7){
+    printf("%s: writev to file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memset(b, 0, sizeof(b));
+  iov[0].iov_base = a;
+  iov[2].iov_base = c;
+  fd = open("iovf", O_RDONLY);
+  if(fd < 0 || readv(fd, iov, 3) != 5 + sizeof(b) + 7){
+    printf("%s: readv from file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovf");
+  if(memcmp(a, "head:", 5) != 0 || strcmp(c, ":trail") != 0){
+    printf("%s: readv got wrong data\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != (char)i){
+      printf("%s: readv got wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(writev(fds[1], iov, 3) != 5 + sizeof(b) + 7){
+    printf("%s: writev to pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, sizeof(buf)) != 5 + sizeof(b) + 7 ||
+     memcmp(buf, "head:", 5) != 0 || memcmp(buf + 5 + sizeof(b), ":trail", 7) != 0){
+    printf("%s: read of writev to pipe got wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+
+  if(writev(1, iov, IOV_MAX + 1) != -1){
+    printf("%s: writev of too many buffers succeeded\n", s);
+    exit(1);
+  }
+}
+
+// pread() and pwrite() by several processes sharing
+// one descriptor, each on its own part of the file.
+void
+preadtest(char *s)
+{
+  enum { NCHILD = 4, PART = 2000 };
+  char b[PART];
+  int fd, fds[2], i, j, pid, xstatus;
+
+  fd = open("preadf", O_CREATE|O_RDWR|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      memset(b, 'a' + i, sizeof(b));
+      if(pwrite(fd, b, PART, i * PART) != PART){
+        printf("%s: pwrite failed\n", s);
+        exit(1);
+      }
+      memset(b, 0, sizeof(b));
+      if(pread(fd, b, PART, i * PART) != PART){
+        printf("%s: pread failed\n", s);
+        exit(1);
+      }
+      for(j = 0; j < PART; j++){
+        if(b[j] != 'a' + i){
+          printf("%s: pread got wrong data\n", s);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  // the shared offset never moved.
+  if(read(fd, b, 1) != 1 || b[0] != 'a'){
+    printf("%s: pwrite moved the file offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, PART, NCHILD * PART - 1) != 1 || b[0] != 'a' + NCHILD - 1){
+    printf("%s: pread at end of file\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 1, -1) != -1){
+    printf("%s: pread at negative offset succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("preadf");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1 || pread(fds[0], b, 1, 0) != -1){
+    printf("%s: pread/pwrite on a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// poll() on pipes: readiness, blocking until a
+// write, timeouts, and closed ends.
+void
+polltest(char *s)
+{
+  struct pollfd pfd[3];
+  int a[2], b[2], pid, t0;
+  char c;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = a[1];
+  pfd[2].events = POLLOUT;
+  if(poll(pfd, 3, 0) != 1 || pfd[0].revents || pfd[1].revents ||
+     pfd[2].revents != POLLOUT){
+    printf("%s: poll of empty pipes\n", s);
+    exit(1);
+  }
+
+  // nothing to read: a timed poll runs out.
+  t0 = uptime();
+  if(poll(pfd, 2, 3) != 0 || uptime() - t0 < 3){
+    printf("%s: poll timeout\n", s);
+    exit(1);
+  }
+
+  // block until a child writes to the second pipe.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents || pfd[1].revents != POLLIN ||
+     read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: poll did not see the write\n", s);
+    exit(1);
+  }
+  wait(0);
+
+  // closing the write end wakes a poller with POLLHUP,
+  // and closing the read end shows POLLERR to writers.
+  close(b[1]);
+  if(poll(pfd, 2, -1) != 1 || pfd[1].revents != POLLHUP){
+    printf("%s: poll after close of write end\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  if(poll(&pfd[2], 1, 0) != 1 || pfd[2].revents != POLLERR){
+    printf("%s: poll after close of read end\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[1].fd = -1;
+  if(poll(pfd, 2, 0) != 1 || pfd[0].revents != POLLNVAL || pfd[1].revents){
+    printf("%s: poll of a closed fd\n", s);
+    exit(1);
+  }
+  close(a[1]);
+  close(b[0]);
+}
+
+// O_NONBLOCK pipes fail with -EAGAIN instead of waiting.
+void
+nonblocktest(char *s)
+{
+  int fds[2], n, tot, fd;
+  char c;
+
+  if(pipe2(fds, O_NONBLOCK) != 0){
+    printf("%s: pipe2() failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], &c, 1) != -EAGAIN){
+    printf("%s: read of empty pipe did not fail with EAGAIN\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_GETFL, 0) != (O_WRONLY | O_NONBLOCK)){
+    printf("%s: F_GETFL\n", s);
+    exit(1);
+  }
+
+  // fill the pipe; the last write is short, and then
+  // writes fail.
+  tot = 0;
+  while((n = write(fds[1], buf, sizeof(buf))) > 0)
+    tot += n;
+  if(n != -EAGAIN || tot != fcntl(fds[1], F_GETPIPE_SZ, 0)){
+    printf("%s: filling the pipe wrote %d, then got %d\n", s, tot, n);
+    exit(1);
+  }
+  // splice() doesn't wait either, in either direction.
+  fd = open("nbfile", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create nbfile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("nbfile", O_RDWR);
+  if(splice(fd, fds[1], 1) != -EAGAIN){
+    printf("%s: splice into a full pipe did not fail with EAGAIN\n", s);
+    exit(1);
+  }
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    tot -= n;
+  if(n != -EAGAIN || tot != 0){
+    printf("%s: draining the pipe\n", s);
+    exit(1);
+  }
+  if(splice(fds[0], fd, 1) != -EAGAIN){
+    printf("%s: splice from an empty pipe did not fail with EAGAIN\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("nbfile");
+
+  // with O_NONBLOCK cleared, read() waits for the
+  // writer, and sees end-of-file once it has gone.
+  if(fcntl(fds[0], F_SETFL, 0) != 0 || fcntl(fds[0], F_GETFL, 0) != O_RDONLY){
+    printf("%s: F_SETFL\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf("%s: read after close of write end\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+
+  if(pipe2(fds, O_CREATE) != -1){
+    printf("%s: pipe2() with a bad flag succeeded\n", s);
+    exit(1);
+  }
+}
+
+volatile int tcount[4];
+char *volatile tmem;
+int tfds[2];
+
+void
+threadfn(void *a)
+{
+  int id = (uint64)a;
+
+  for(int i = 0; i < 1000; i++)
+    tcount[id]++;
+  if(id == 0){
+    // memory grown by one thread is there for the others.
+    tmem = sbrk(PGSIZE);
+    if(tmem != (char*)-1)
+      tmem[0] = 'x';
+  }
+  if(id == 1){
+    // so are files opened by one thread.
+    if(pipe(tfds) == 0)
+      write(tfds[1], "y", 1);
+  }
+}
+
+void
+threadspin(void *a)
+{
+  for(;;)
+    ;
+}
+
+// threads made with clone() share memory, and exit()
+// takes a process's threads with it.
+void
+threadtest(char *s)
+{
+  int i, pid, xst;
+  char c;
+  char *args[] = { "echo", 0 };
+
+  for(i = 0; i < 4; i++){
+    if(kthread_create(threadfn, (void*)(uint64)i) < 0){
+      printf("%s: kthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(kthread_join() < 0){
+      printf("%s: kthread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(kthread_join() != -1){
+    printf("%s: kthread_join with no threads succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    if(tcount[i] != 1000){
+      printf("%s: thread %d counted %d\n", s, i, tcount[i]);
+      exit(1);
+    }
+  }
+  if(tmem == (char*)-1 || tmem[0] != 'x'){
+    printf("%s: memory grown by a thread\n", s);
+    exit(1);
+  }
+  if(read(tfds[0], &c, 1) != 1 || c != 'y'){
+    printf("%s: pipe opened by a thread\n", s);
+    exit(1);
+  }
+  close(tfds[0]);
+  close(tfds[1]);
+  if(clone(threadfn, 0, (void*)(tmem + 8)) != -1){
+    printf("%s: clone() with a misaligned stack succeeded\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 2; i++)
+      if(kthread_create(threadspin, 0) < 0)
+        exit(1);
+    // fork() and exec() refuse while there are threads.
+    if((i = fork()) == 0)
+      exit(0);
+    if(i != -1)
+      exit(1);
+    exec("echo", args);
+    exit(7);
+  }
+  wait(&xst);
+  if(xst != 7){
+    printf("%s: threaded child exited with %d\n", s, xst);
+    exit(1);
+  }
+}
+
+struct mutex fmutex;
+struct cond fcond;
+volatile int fcount, fready, fword;
+
+void
+futexfn(void *a)
+{
+  for(int i = 0; i < 1000; i++){
+    mutex_lock(&fmutex);
+    fcount++;
+    mutex_unlock(&fmutex);
+  }
+  mutex_lock(&fmutex);
+  while(!fready)
+    cond_wait(&fcond, &fmutex);
+  fcount++;
+  mutex_unlock(&fmutex);
+}
+
+void
+futexwaiter(void *a)
+{
+  while(fword == 0)
+    futex_wait(&fword, 0);
+}
+
+// futex_wait() and futex_wake(), and the mutexes and
+// condition variables made from them.
+void
+futextest(char *s)
+{
+  int i, fds[2];
+  char c;
+
+  fcount = 0;
+  if(futex_wait(&fcount, 1) != -EAGAIN){
+    printf("%s: futex_wait on a changed word did not fail with EAGAIN\n", s);
+    exit(1);
+  }
+  if(futex_wait((int*)((char*)&fcount + 1), 0) != -1){
+    printf("%s: futex_wait on a misaligned word succeeded\n", s);
+    exit(1);
+  }
+  if(futex_wake(&fcount, 1) != 0){
+    printf("%s: futex_wake woke someone\n", s);
+    exit(1);
+  }
+
+  mutex_init(&fmutex);
+  cond_init(&fcond);
+  fready = 0;
+  for(i = 0; i < 4; i++){
+    if(kthread_create(futexfn, 0) < 0){
+      printf("%s: kthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  // let them get to cond_wait().
+  for(i = 0; i < 100 && fcount != 4000; i++)
+    sleep(1);
+  mutex_lock(&fmutex);
+  if(fcount != 4000){
+    printf("%s: threads counted %d\n", s, fcount);
+    exit(1);
+  }
+  fready = 1;
+  cond_broadcast(&fcond);
+  mutex_unlock(&fmutex);
+  for(i = 0; i < 4; i++){
+    if(kthread_join() < 0){
+      printf("%s: kthread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(fcount != 4004){
+    printf("%s: threads counted %d after the broadcast\n", s, fcount);
+    exit(1);
+  }
+
+  // a thread can wait on a word whose page is shared
+  // copy-on-write with a child.
+  fword = 0;
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  i = fork();
+  if(i < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(i == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit(0);
+  }
+  close(fds[0]);
+  if(kthread_create(futexwaiter, 0) < 0){
+    printf("%s: kthread_create failed\n", s);
+    exit(1);
+  }
+  sleep(2);
+  fword = 1;
+  futex_wake(&fword, 1);
+  if(kthread_join() < 0){
+    printf("%s: kthread_join failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  wait(0);
+}
+
+// a writer waiting for another writer, which is itself
+// waiting on a full pipe, can still be killed.
+void
+pipekilltest(char *s)
+{
+  int fds[2], pid1, pid2, xst;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid1 = fork();
+  if(pid1 == 0){
+    for(;;)
+      write(fds[1], buf, sizeof(buf));
+  }
+  sleep(5);
+  pid2 = fork();
+  if(pid2 == 0){
+    write(fds[1], buf, 1);
+    exit(0);
+  }
+  if(pid1 < 0 || pid2 < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  sleep(5);
+  kill(pid2);
+  if(wait(&xst) != pid2 || xst != -1){
+    printf("%s: waiting writer was not killed\n", s);
+    exit(1);
+  }
+  kill(pid1);
+  wait(0);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a running program's file can't be written, since its
+// pages are read from the file as the program touches them.
+void
+textbusytest(char *s)
+{
+  char *args[] = { "sleep", "100", 0 };
+  int pid, fd;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exec("sleep", args);
+    exit(1);
+  }
+  sleep(10);
+  if(open("sleep", O_WRONLY) >= 0 || open("sleep", O_RDONLY | O_TRUNC) >= 0){
+    printf("%s: opened a running program for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("sleep", O_RDONLY)) < 0){
+    printf("%s: open sleep for reading failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  kill(pid);
+  wait(0);
+  if((fd = open("sleep", O_RDWR)) < 0){
+    printf("%s: open sleep for writing after it exited failed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
 
 // test if child is killed (status = -1)
 void
@@ -1916,6 +2608,77 @@ dirfile(char *s)
   close(fd);
 }
 
+// a directory that outgrows its first block is indexed;
+// "." and ".." must still be found in it.
+void
+dirindextest(char *s)
+{
+  enum { N = 100 };
+  char name[16];
+  struct stat st;
+  int i, fd;
+
+  if(mkdir("ixdir") != 0){
+    printf("%s: mkdir ixdir failed\n", s);
+    exit(1);
+  }
+  memmove(name, "ixdir/f00", 10);
+  for(i = 0; i < N; i++){
+    name[7] = '0' + i / 10;
+    name[8] = '0' + i % 10;
+    if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fd = open("ixdir/.", O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0 || st.type != T_DIR){
+    printf("%s: open ixdir/. failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("ixdir/./f42", O_RDONLY)) < 0){
+    printf("%s: open ixdir/./f42 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(chdir("ixdir") != 0 || (fd = open(".", O_RDONLY)) < 0){
+    printf("%s: chdir ixdir failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(chdir("..") != 0 || (fd = open("ixdir/f07", O_RDONLY)) < 0){
+    printf("%s: chdir .. failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(unlink("ixdir/f42") != 0 || open("ixdir/f42", O_RDONLY) >= 0){
+    printf("%s: unlink ixdir/f42 failed\n", s);
+    exit(1);
+  }
+  if(link("ixdir/f43", "ixdir/f42") != 0 || (fd = open("ixdir/f42", O_RDONLY)) < 0){
+    printf("%s: relink ixdir/f42 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[7] = '0' + i / 10;
+    name[8] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("ixdir") != 0){
+    printf("%s: unlink ixdir failed\n", s);
+    exit(1);
+  }
+}
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void
@@ -2571,6 +3334,120 @@ badarg(char *s)
   exit(0);
 }
 
+// read mmapfile into buf, and return its length.
+int
+mmapread(void)
+{
+  int fd, n;
+
+  if((fd = open("mmapfile", O_RDONLY)) < 0)
+    return -1;
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  return n;
+}
+
+// mmap() a file shared and private, check what reaches the file,
+// and that a forked child shares a MAP_SHARED mapping.
+void
+mmaptest(char *s)
+{
+  enum { N = 2*PGSIZE + 100 };
+  int fd, i, pid, xstatus;
+  char *p, c;
+
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapfile failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    c = 'a' + i % 23;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write mmapfile failed\n", s);
+      exit(1);
+    }
+  }
+
+  // a shared mapping sees the file, reads zero past its
+  // end, and writes its changes back on munmap.
+  p = mmap(0, 3*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*PGSIZE; i++){
+    if(p[i] != (i < N ? 'a' + i % 23 : 0)){
+      printf("%s: wrong mmap content at %d\n", s, i);
+      exit(1);
+    }
+  }
+  p[1] = 'X';
+  p[N-1] = 'Y';
+  p[N] = 'Z';
+  if(munmap(p, 3*PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(mmapread() != N || buf[1] != 'X' || buf[N-1] != 'Y'){
+    printf("%s: shared mapping not written back\n", s);
+    exit(1);
+  }
+
+  // a private mapping doesn't change the file.
+  p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  p[2] = 'Q';
+  munmap(p, N);
+  if(mmapread() != N || buf[2] != 'c'){
+    printf("%s: private mapping written back\n", s);
+    exit(1);
+  }
+
+  // a forked child shares a MAP_SHARED mapping, and read()
+  // can fill pages that haven't been touched yet.
+  p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[0] = 'P';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 'C';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[0] != 'C'){
+    printf("%s: fork didn't share mapping\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, p + PGSIZE, 10) != 10 || p[PGSIZE] != 'C'){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+
+  // can't map a read-only file shared and writable.
+  if(mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: mmap of read-only file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  munmap(p, N);
+  unlink("mmapfile");
+  exit(0);
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2594,6 +3471,16 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipesz, "pipesz"},
+  {splicetest, "splicetest"},
+  {iovtest, "iovtest"},
+  {preadtest, "preadtest"},
+  {polltest, "polltest"},
+  {nonblocktest, "nonblocktest"},
+  {threadtest, "threadtest"},
+  {futextest, "futextest"},
+  {pipekilltest, "pipekilltest"},
+  {textbusytest, "textbusytest"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2616,6 +3503,7 @@ struct test {
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
+  {dirindextest, "dirindextest"},
   {iref, "iref"},
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
@@ -2635,6 +3523,7 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {mmaptest, "mmaptest" },
 
   { 0, 0},
 };
@@ -36,3 +36,18 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("lockstat");
+entry("mmap");
+entry("munmap");
+entry("fcntl");
+entry("splice");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("poll");
+entry("pipe2");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
@@ -0,0 +1,67 @@
+// Count the lock acquisitions behind sleep() and wakeup()
+// in a pipe ping-pong.
+//
+// usage: wakebench
+//
+// Two processes bounce a byte over a pair of pipes ROUNDS
+// times. Every read that finds its pipe empty sleeps, and
+// every write wakes the reader, so the acquire counts of
+// the proc locks show how much work each wakeup() does.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS 2000
+
+int
+main(int argc, char *argv[])
+{
+  uint64 p0[2], p1[2], a0[2], a1[2];
+  int ab[2], ba[2];
+  int i, pid, start, t;
+  char c;
+
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    fprintf(2, "wakebench: pipe failed\n");
+    exit(1);
+  }
+
+  lockstat("proc", p0);
+  lockstat("", a0);
+  start = uptime();
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "wakebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < ROUNDS; i++){
+      if(read(ab[0], &c, 1) != 1)
+        exit(1);
+      write(ba[1], &c, 1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < ROUNDS; i++){
+    write(ab[1], "x", 1);
+    if(read(ba[0], &c, 1) != 1){
+      fprintf(2, "wakebench: read failed\n");
+      break;
+    }
+  }
+  wait(0);
+
+  t = uptime() - start;
+  lockstat("proc", p1);
+  lockstat("", a1);
+  if(t == 0)
+    t = 1;
+  printf("wakebench: %d round trips in %d ticks\n", ROUNDS, t);
+  printf("wakebench: proc lock acquires %l (%l per tick)\n",
+         p1[0] - p0[0], (p1[0] - p0[0]) / t);
+  printf("wakebench: all lock acquires %l (%l per tick)\n",
+         a1[0] - a0[0], (a1[0] - a0[0]) / t);
+  exit(0);
+}
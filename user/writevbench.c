@@ -0,0 +1,72 @@
+// Compare writing header+payload records to a file with
+// two write()s and with one writev().
+//
+// usage: writevbench [nrecords]
+//
+// Each write() to a file is at least one log transaction;
+// writev() puts a whole record in one.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PAYLOAD 500
+
+char head[16] = "record header\n";
+char payload[PAYLOAD];
+
+// Write nrec records. Returns ticks.
+int
+run(int nrec, int vectored)
+{
+  struct iovec iov[2];
+  int fd, i, start;
+
+  fd = open("wvfile", O_CREATE | O_TRUNC | O_WRONLY);
+  if(fd < 0){
+    fprintf(2, "writevbench: create failed\n");
+    exit(1);
+  }
+  iov[0].iov_base = head;
+  iov[0].iov_len = sizeof(head);
+  iov[1].iov_base = payload;
+  iov[1].iov_len = sizeof(payload);
+
+  start = uptime();
+  for(i = 0; i < nrec; i++){
+    if(vectored){
+      if(writev(fd, iov, 2) != sizeof(head) + sizeof(payload))
+        goto bad;
+    } else {
+      if(write(fd, head, sizeof(head)) != sizeof(head) ||
+         write(fd, payload, sizeof(payload)) != sizeof(payload))
+        goto bad;
+    }
+  }
+  close(fd);
+  return uptime() - start;
+
+ bad:
+  fprintf(2, "writevbench: write failed\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nrec;
+
+  nrec = 1000;
+  if(argc > 1)
+    nrec = atoi(argv[1]);
+  if(nrec < 1){
+    fprintf(2, "usage: writevbench [nrecords]\n");
+    exit(1);
+  }
+
+  printf("writevbench: %d records with write: %d ticks\n", nrec, run(nrec, 0));
+  printf("writevbench: %d records with writev: %d ticks\n", nrec, run(nrec, 1));
+  unlink("wvfile");
+  exit(0);
+}